@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "memory.h"
+#include "source_file.h"
+#include "strings.h"
+
+#define MAX_WORKERS 64
+
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+} FileList;
+
+typedef struct {
+    FileList *files;
+    bool fill_cache;
+    atomic_int next;
+    atomic_int failed;
+    atomic_int cached;
+} Batch;
+
+static void add_file(FileList *files, const char *path) {
+    if (files->count + 1 >= files->capacity) {
+        int old_capacity = files->capacity;
+        files->capacity = GROW_ARRAY_CAPACITY(old_capacity);
+        files->paths = GROW_ARRAY(files->paths, char *, old_capacity, files->capacity, MEMORY_TEMPORARY);
+    }
+
+    files->paths[files->count++] = strdup(path);
+}
+
+static bool has_extension(const char *name, const char *extension) {
+    size_t name_length = strlen(name);
+    size_t extension_length = strlen(extension);
+    return name_length > extension_length && strcmp(name + name_length - extension_length, extension) == 0;
+}
+
+static void collect_files(FileList *files, const char *directory) {
+    DIR *dir = opendir(directory);
+
+    if (dir == NULL) {
+        fprintf(stderr, "Could not open directory %s\n", directory);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char *path = malloc(strlen(directory) + strlen(entry->d_name) + 2);
+        sprintf(path, "%s/%s", directory, entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info) == 0) {
+            if (S_ISDIR(info.st_mode)) {
+                collect_files(files, path);
+            } else if (S_ISREG(info.st_mode) && has_extension(entry->d_name, ".fi")) {
+                add_file(files, path);
+            }
+        }
+
+        free(path);
+    }
+
+    closedir(dir);
+}
+
+// compile_segments() hands each segment over on its own, every thread writes the file it compiles
+static _Thread_local BytecodeWriter *segment_writer;
+
+static bool write_segment(Chunk *chunk, const char *) {
+    return write_bytecode_segment(segment_writer, chunk);
+}
+
+// the cache file is the one a run of the script would have written, segment for segment
+static bool compile_file(Batch *batch, const char *path) {
+    SourceFile source;
+
+    if (!map_source_file(path, &source)) {
+        fprintf(stderr, "Could not read file %s\n", path);
+        return false;
+    }
+
+    char *cache_path = NULL;
+    uint8_t digest[SOURCE_DIGEST_SIZE];
+    if (batch->fill_cache && source.length >= CACHE_MIN_BYTES) {
+        digest_source(source.chars, source.length, digest);
+        cache_path = bytecode_cache_path(digest);
+    }
+
+    BytecodeWriter writer;
+    bool caching = cache_path != NULL && open_bytecode_writer(&writer, cache_path, digest, source.length);
+    if (cache_path != NULL && !caching) fprintf(stderr, "Could not write %s\n", cache_path);
+
+    Chunk chunk;
+    Hashmap strings;
+    init_chunk(&chunk);
+    init_hashmap(&strings);
+
+    segment_writer = caching ? &writer : NULL;
+    bool compiled = caching ? compile_segments(&chunk, source.chars, source.length, &strings, write_segment)
+                            : compile(&chunk, source.chars, source.length, &strings);
+    if (!compiled) {
+        fprintf(stderr, "%s: compilation failed\n", path);
+    }
+
+    // a failed write stops the compiler early without an error, the file is incomplete then
+    bool written = cache_path == NULL || (caching && !writer.failed);
+    if (caching && (!close_bytecode_writer(&writer, compiled && written) || (compiled && !written))) {
+        fprintf(stderr, "Could not write %s\n", cache_path);
+        written = false;
+    }
+    if (caching && compiled && written) atomic_fetch_add(&batch->cached, 1);
+
+    free_chunk(&chunk);
+    free_strings(&strings);
+    unmap_source_file(&source);
+    free(cache_path);
+    return compiled && written;
+}
+
+static void *worker(void *argument) {
+    Batch *batch = argument;
+
+    for (;;) {
+        int index = atomic_fetch_add(&batch->next, 1);
+        if (index >= batch->files->count) break;
+
+        if (!compile_file(batch, batch->files->paths[index])) {
+            atomic_fetch_add(&batch->failed, 1);
+        }
+    }
+
+    return NULL;
+}
+
+bool compile_all(const char *directory, bool fill_cache) {
+    FileList files = {NULL, 0, 0};
+    collect_files(&files, directory);
+
+    Batch batch;
+    batch.files = &files;
+    batch.fill_cache = fill_cache;
+    atomic_init(&batch.next, 0);
+    atomic_init(&batch.failed, 0);
+    atomic_init(&batch.cached, 0);
+
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) workers = 1;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    if (workers > files.count) workers = files.count > 0 ? files.count : 1;
+
+    pthread_t threads[MAX_WORKERS];
+    long started = 0;
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, worker, &batch) != 0) break;
+    }
+
+    // if no thread could be started the work is done here
+    if (started == 0) worker(&batch);
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int failed = atomic_load(&batch.failed);
+    printf("compiled %d files, %d failed, %d cached\n", files.count - failed, failed, atomic_load(&batch.cached));
+
+    for (int i = 0; i < files.count; i++) {
+        free(files.paths[i]);
+    }
+    FREE_ARRAY(files.paths, char *, files.capacity, MEMORY_TEMPORARY);
+
+    return failed == 0;
+}
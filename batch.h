@@ -0,0 +1,13 @@
+#ifndef FILANG_BATCH_H
+#define FILANG_BATCH_H
+
+#include <stdbool.h>
+
+/*
+ * Compiles every .fi file found under directory on a pool of threads, without running them. With fill_cache,
+ * the bytecode of those big enough to be looked up in the cache is written to it, as a run would.
+ * Returns false if a file could not be read or compiled, or its bytecode not written.
+ */
+bool compile_all(const char *directory, bool fill_cache);
+
+#endif //FILANG_BATCH_H
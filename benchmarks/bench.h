@@ -0,0 +1,82 @@
+#ifndef FILANG_BENCH_H
+#define FILANG_BENCH_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../stats.h"
+
+/*
+ * Helpers shared by the benchmarks: a growing buffer to generate scripts into, and the best wall
+ * time of running a command, filang on a generated script for instance, a few times over.
+ */
+typedef struct {
+    char *chars;
+    size_t length;
+    size_t capacity;
+} Text;
+
+static void append(Text *text, const char *format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        size_t room = text->capacity - text->length;
+        int written = vsnprintf(text->chars + text->length, room, format, args);
+        va_end(args);
+
+        if ((size_t) written < room) {
+            text->length += (size_t) written;
+            return;
+        }
+
+        text->capacity = text->capacity < 4096 ? 4096 : text->capacity * 2;
+        if (text->capacity < text->length + (size_t) written + 1) text->capacity = text->length + written + 1;
+        text->chars = realloc(text->chars, text->capacity);
+        if (text->chars == NULL) exit(1);
+    }
+}
+
+static void free_text(Text *text) {
+    free(text->chars);
+    *text = (Text) {NULL, 0, 0};
+}
+
+static bool write_file(const char *path, const Text *text) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    bool written = fwrite(text->chars, 1, text->length, file) == text->length;
+    return fclose(file) == 0 && written;
+}
+
+// seconds of the fastest of repeats runs with the output thrown away, -1 if one of them failed
+static double best_run(char *const argv[], int repeats) {
+    double best = -1;
+    for (int i = 0; i < repeats; i++) {
+        double start = now_seconds();
+        pid_t child = fork();
+        if (child == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execv(argv[0], argv);
+            _exit(127);
+        }
+
+        int status;
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return -1;
+        }
+
+        double elapsed = now_seconds() - start;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+#endif //FILANG_BENCH_H
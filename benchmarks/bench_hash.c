@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../hash.h"
+
+/*
+ * Hashing speed by key length next to FNV-1a, the hash strings used before seeding, in ns a key and
+ * GB/s. Lengths from LONG_HASH_MIN on go through the striped kernel, built here as AVX2, SSE2 or
+ * portable depending on the target.
+ */
+#define BUFFER_BYTES (1 << 20)
+#define BYTES_PER_RUN 200000000L
+#define REPEATS 3
+
+static uint32_t fnv1a(const char *key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t fnv1a_int(int64_t key) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 8; i++) {
+        hash ^= (uint8_t) (key >> 8 * i);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static volatile uint32_t sink;
+
+// seconds per key, keys start at a different offset each time so that they are not all aligned
+static double time_strings(uint32_t (*hash)(const char *key, int length), const char *buffer, int length) {
+    long keys = BYTES_PER_RUN / (length + 20);
+    double best = -1;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        uint32_t combined = 0;
+        double start = now_seconds();
+        for (long i = 0; i < keys; i++) {
+            combined += hash(buffer + (i & 255), length);
+        }
+        double elapsed = now_seconds() - start;
+        sink += combined;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+    return best / keys;
+}
+
+static double time_integers(uint32_t (*hash)(int64_t key)) {
+    long keys = 50000000;
+    double best = -1;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        uint32_t combined = 0;
+        double start = now_seconds();
+        for (long i = 0; i < keys; i++) {
+            combined += hash(i);
+        }
+        double elapsed = now_seconds() - start;
+        sink += combined;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+    return best / keys;
+}
+
+int main() {
+#if defined(__AVX2__)
+    const char *kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char *kernel = "SSE2";
+#else
+    const char *kernel = "portable";
+#endif
+    init_hash_seed();
+
+    char *buffer = malloc(BUFFER_BYTES);
+    uint32_t random = 12345;
+    for (int i = 0; i < BUFFER_BYTES; i++) {
+        random = random * 1103515245 + 12345;
+        buffer[i] = (char) ('a' + (random >> 16) % 26);
+    }
+
+    printf("%s kernel\n", kernel);
+    printf("%-8s %10s %10s %10s %10s\n", "length", "fnv ns", "hash ns", "fnv GB/s", "hash GB/s");
+    static const int lengths[] = {4, 8, 16, 32, 64, 128, 256, 1023, 1024, 4096, 65536};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        int length = lengths[i];
+        double fnv = time_strings(fnv1a, buffer, length);
+        double seeded = time_strings(hash_string, buffer, length);
+        printf("%-8d %10.2f %10.2f %10.2f %10.2f\n", length, fnv * 1e9, seeded * 1e9, length / fnv / 1e9,
+               length / seeded / 1e9);
+    }
+    printf("%-8s %10.2f %10.2f\n", "integer", time_integers(fnv1a_int) * 1e9, time_integers(hash_int) * 1e9);
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+/*
+ * Compile throughput with many locals in a block: generates scripts whose blocks declare thousands
+ * of locals, each initialised from and assigned to earlier ones, and times filang --compile-only on them.
+ *
+ *     bench_locals <path to filang> [directory for the scripts, /tmp by default]
+ */
+
+#define REPEATS 5
+
+static void generate(Text *text, int blocks, int locals) {
+    for (int block = 0; block < blocks; block++) {
+        append(text, "{\n:l0 = %d;\n", block);
+        for (int i = 1; i < locals; i++) {
+            append(text, ":l%d = l%d + %d;\n", i, i / 2, i);
+        }
+        for (int i = 0; i < locals; i++) {
+            append(text, "l%d = l%d;\n", (int) (((long) i * 104729) % locals), i);
+        }
+        append(text, "print l%d;\n}\n", locals - 1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench_locals <filang> [directory]\n");
+        return 1;
+    }
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+
+    static const struct {
+        int blocks;
+        int locals;
+    } shapes[] = {{1, 1000}, {1, 10000}, {1, 50000}, {1, 100000}, {10, 10000}};
+
+    printf("%-8s %-8s %10s %10s %14s %10s\n", "blocks", "locals", "bytes", "ms", "locals/s", "MB/s");
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        Text text = {NULL, 0, 0};
+        generate(&text, shapes[i].blocks, shapes[i].locals);
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/filang_locals_%dx%d.fi", directory, shapes[i].blocks, shapes[i].locals);
+        if (!write_file(path, &text)) {
+            fprintf(stderr, "Could not write %s\n", path);
+            return 1;
+        }
+
+        char *command[] = {argv[1], "--compile-only", path, NULL};
+        double seconds = best_run(command, REPEATS);
+        if (seconds < 0) {
+            fprintf(stderr, "%s --compile-only %s failed\n", argv[1], path);
+            return 1;
+        }
+
+        double locals = (double) shapes[i].blocks * shapes[i].locals;
+        printf("%-8d %-8d %10zu %10.2f %14.0f %10.1f\n", shapes[i].blocks, shapes[i].locals, text.length,
+               seconds * 1e3, locals / seconds, (double) text.length / seconds / 1e6);
+        free_text(&text);
+    }
+
+    return 0;
+}
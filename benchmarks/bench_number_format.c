@@ -0,0 +1,103 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../number_format.h"
+
+/*
+ * Nanoseconds per number for format_integer() and format_decimal() next to snprintf, on the numbers
+ * scripts mostly print, small integers and short decimals, and on random ones. "%.17g" always reads
+ * back but writes 17 digits, "%.15g" is shorter but does not always read back.
+ */
+#define COUNT (1 << 20)
+#define REPEATS 5
+
+static uint64_t state = 0x853C49E6748FEA9Bu;
+
+static uint64_t next_random() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+typedef enum {
+    FORMAT_INTEGER,
+    FORMAT_DECIMAL,
+    SNPRINTF_INTEGER,
+    SNPRINTF_17G,
+    SNPRINTF_15G,
+} Formatter;
+
+// bytes written, summed so that the formatting is not optimised away
+static size_t volatile sink;
+
+static double time_format(Formatter formatter, const int64_t *integers, const double *decimals) {
+    double best = -1;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        char buffer[NUMBER_BUFFER];
+        size_t written = 0;
+        double start = now_seconds();
+
+        for (int i = 0; i < COUNT; i++) {
+            switch (formatter) {
+                case FORMAT_INTEGER: written += format_integer(integers[i], buffer); break;
+                case FORMAT_DECIMAL: written += format_decimal(decimals[i], buffer); break;
+                case SNPRINTF_INTEGER: written += snprintf(buffer, sizeof(buffer), "%" PRId64, integers[i]); break;
+                case SNPRINTF_17G: written += snprintf(buffer, sizeof(buffer), "%.17g", decimals[i]); break;
+                case SNPRINTF_15G: written += snprintf(buffer, sizeof(buffer), "%.15g", decimals[i]); break;
+            }
+        }
+
+        double elapsed = now_seconds() - start;
+        sink += written;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+
+    return best * 1e9 / COUNT;
+}
+
+int main() {
+    int64_t *small = malloc(sizeof(int64_t) * COUNT);
+    int64_t *large = malloc(sizeof(int64_t) * COUNT);
+    double *short_decimals = malloc(sizeof(double) * COUNT);
+    double *random_decimals = malloc(sizeof(double) * COUNT);
+
+    for (int i = 0; i < COUNT; i++) {
+        small[i] = (int64_t) (next_random() % 2000) - 1000;
+        large[i] = (int64_t) next_random();
+        int64_t digits = (int64_t) (next_random() % 200001) - 100000;
+        short_decimals[i] = (double) digits / pow(10, (double) (next_random() % 4));
+
+        uint64_t bits;
+        do {
+            bits = next_random();
+            memcpy(&random_decimals[i], &bits, sizeof(bits));
+        } while (!isfinite(random_decimals[i]));
+    }
+
+    printf("%-26s %14s %12s\n", "numbers", "formatter", "ns/number");
+    printf("%-26s %14s %12.1f\n", "integers in -1000..999", "format_integer", time_format(FORMAT_INTEGER, small, NULL));
+    printf("%-26s %14s %12.1f\n", "", "%" PRId64, time_format(SNPRINTF_INTEGER, small, NULL));
+    printf("%-26s %14s %12.1f\n", "random integers", "format_integer", time_format(FORMAT_INTEGER, large, NULL));
+    printf("%-26s %14s %12.1f\n", "", "%" PRId64, time_format(SNPRINTF_INTEGER, large, NULL));
+
+    const struct {
+        const char *name;
+        const double *decimals;
+    } sets[] = {{"decimals of 1-3 places", short_decimals}, {"random doubles", random_decimals}};
+
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        const double *decimals = sets[i].decimals;
+        printf("%-26s %14s %12.1f\n", sets[i].name, "format_decimal", time_format(FORMAT_DECIMAL, NULL, decimals));
+        printf("%-26s %14s %12.1f\n", "", "%.17g", time_format(SNPRINTF_17G, NULL, decimals));
+        printf("%-26s %14s %12.1f\n", "", "%.15g", time_format(SNPRINTF_15G, NULL, decimals));
+    }
+
+    free(small);
+    free(large);
+    free(short_decimals);
+    free(random_decimals);
+    return 0;
+}
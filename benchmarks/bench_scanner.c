@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../scanner.h"
+#include "../source_file.h"
+
+/*
+ * Scanner throughput on its own: every token of a source is scanned and thrown away, nothing is
+ * compiled. Generated sources stress the paths that are vectorised or special cased, code with
+ * keywords and identifiers, long comments, long strings and number literals.
+ *
+ *     bench_scanner [script to scan instead of the generated ones]
+ */
+
+#define SOURCE_BYTES (32 << 20)
+#define REPEATS 5
+
+static void generate_code(Text *text) {
+    append(text, ":count = 1;\n:limit = 2;\n:done = false;\n");
+    for (int i = 0; text->length < SOURCE_BYTES; i++) {
+        append(text, ":value_%d = (count + %d) * 2;\n", i, i);
+        append(text, "? (value_%d > limit and not done) {\n    print \"big \" + value_%d;\n} : {\n", i, i);
+        append(text, "    print typeof value_%d == \"number\" or false;\n}\n", i);
+    }
+}
+
+static void generate_comments(Text *text) {
+    for (int i = 0; text->length < SOURCE_BYTES; i++) {
+        append(text, "# %d: the comment runs on with nothing in it the scanner has to look at until the end\n", i);
+        append(text, "print %d;\n", i);
+    }
+}
+
+static void generate_strings(Text *text) {
+    for (int i = 0; text->length < SOURCE_BYTES; i++) {
+        append(text, "print \"string %d has a long body without interpolation or escapes in it at all\";\n", i);
+        append(text, "print 'and %d a single quoted one of the same kind, up to its closing quote';\n", i);
+    }
+}
+
+static void generate_numbers(Text *text) {
+    for (int i = 0; text->length < SOURCE_BYTES; i++) {
+        append(text, "print %d + %d.%d * 0.%d - %d;\n", i, i % 1000, i % 97, i % 7919, i * 31);
+    }
+}
+
+// seconds of the fastest of REPEATS scans, tokens is set to how many tokens were scanned
+static double scan_all(const char *source, size_t length, long *tokens) {
+    double best = -1;
+    for (int i = 0; i < REPEATS; i++) {
+        double start = now_seconds();
+        Scanner scanner;
+        init_scanner(&scanner, source, length);
+
+        long count = 0;
+        while (scan_token(&scanner).type != TOKEN_EOF) {
+            count++;
+        }
+
+        double elapsed = now_seconds() - start;
+        if (best < 0 || elapsed < best) best = elapsed;
+        *tokens = count;
+    }
+
+    return best;
+}
+
+static void report(const char *name, const char *source, size_t length) {
+    long tokens;
+    double seconds = scan_all(source, length, &tokens);
+    printf("%-10s %10zu %10ld %10.2f %10.1f %12.1f\n", name, length, tokens, seconds * 1e3,
+           (double) length / seconds / 1e6, (double) tokens / seconds / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    printf("%-10s %10s %10s %10s %10s %12s\n", "source", "bytes", "tokens", "ms", "MB/s", "Mtokens/s");
+
+    if (argc > 1) {
+        SourceFile file;
+        if (!map_source_file(argv[1], &file)) {
+            fprintf(stderr, "Could not open %s\n", argv[1]);
+            return 1;
+        }
+
+        report(argv[1], file.chars, file.length);
+        unmap_source_file(&file);
+        return 0;
+    }
+
+    static const struct {
+        const char *name;
+        void (*generate)(Text *text);
+    } sources[] = {
+            {"code",     generate_code},
+            {"comments", generate_comments},
+            {"strings",  generate_strings},
+            {"numbers",  generate_numbers},
+    };
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        Text text = {NULL, 0, 0};
+        sources[i].generate(&text);
+        report(sources[i].name, text.chars, text.length);
+        free_text(&text);
+    }
+
+    return 0;
+}
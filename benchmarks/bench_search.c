@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../search.h"
+#include "../strings.h"
+#include "../vm.h"
+
+/*
+ * Throughput of the string methods over 16MB of English-like text: find() of needles that never
+ * occur, so the whole text is searched, count() of frequent ones, and split(separator, -1), which
+ * walks every separator to the last piece. Finds are compared with a byte at a time search, memchr
+ * with memcmp, and glibc's memmem, counts with a byte at a time count.
+ */
+#define TEXT_BYTES (16 << 20)
+#define REPEATS 5
+
+static int scalar_search(const char *haystack, int length, const char *needle, int needle_length) {
+    for (int i = 0; i + needle_length <= length; i++) {
+        if (haystack[i] == needle[0] && memcmp(haystack + i, needle, needle_length) == 0) return i;
+    }
+    return -1;
+}
+
+static int memchr_search(const char *haystack, int length, const char *needle, int needle_length) {
+    for (int start = 0; start + needle_length <= length;) {
+        const char *found = memchr(haystack + start, needle[0], length - needle_length + 1 - start);
+        if (found == NULL) return -1;
+        if (memcmp(found, needle, needle_length) == 0) return (int) (found - haystack);
+        start = (int) (found - haystack) + 1;
+    }
+    return -1;
+}
+
+static int memmem_search(const char *haystack, int length, const char *needle, int needle_length) {
+    const char *found = memmem(haystack, length, needle, needle_length);
+    return found == NULL ? -1 : (int) (found - haystack);
+}
+
+static int scalar_count(const char *haystack, int length, const char *needle, int needle_length) {
+    int count = 0;
+    for (int i = 0; i + needle_length <= length;) {
+        if (memcmp(haystack + i, needle, needle_length) == 0) {
+            count++;
+            i += needle_length;
+        } else {
+            i++;
+        }
+    }
+    return count;
+}
+
+typedef int (*Search)(const char *haystack, int length, const char *needle, int needle_length);
+
+static volatile long sink;
+
+static double megabytes_per_second(Search search, const char *text, const char *needle) {
+    double best = -1;
+    for (int i = 0; i < REPEATS; i++) {
+        double start = now_seconds();
+        sink += search(text, TEXT_BYTES, needle, (int) strlen(needle));
+        double elapsed = now_seconds() - start;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+    return TEXT_BYTES / best / 1e6;
+}
+
+static double split_megabytes_per_second(Value text, const char *separator) {
+    Value separator_value = STRING_CAST(make_objstring(separator, (int) strlen(separator)));
+    double best = -1;
+    for (int i = 0; i < REPEATS; i++) {
+        int start, length;
+        double begin = now_seconds();
+        split_bounds(text, separator_value, -1, &start, &length);
+        double elapsed = now_seconds() - begin;
+        sink += start;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+    return TEXT_BYTES / best / 1e6;
+}
+
+// the method with its argument quoted, "\n" spelled out
+static const char *label(const char *method, const char *argument) {
+    static char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s(\"%s\")", method, strcmp(argument, "\n") == 0 ? "\\n" : argument);
+    return buffer;
+}
+
+int main() {
+    init_vm();
+
+    static const char *words[] = {"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog, ", "and ",
+                                  "then ", "runs.\n"};
+    char *text = malloc(TEXT_BYTES);
+    uint32_t random = 12345;
+    for (int i = 0; i < TEXT_BYTES;) {
+        random = random * 1103515245 + 12345;
+        const char *word = words[(random >> 16) % (sizeof(words) / sizeof(words[0]))];
+        int length = (int) strlen(word);
+        if (i + length > TEXT_BYTES) length = TEXT_BYTES - i;
+        memcpy(text + i, word, length);
+        i += length;
+    }
+
+    printf("%-22s %12s %12s %14s %12s\n", "MB/s", "search_text", "byte loop", "memchr+memcmp", "memmem");
+    static const char *finds[] = {"zebra", "the lazy cat", "#"};
+    for (size_t i = 0; i < sizeof(finds) / sizeof(finds[0]); i++) {
+        const char *needle = finds[i];
+        printf("%-22s %12.0f %12.0f %14.0f %12.0f\n", label("find", needle),
+               megabytes_per_second(search_text, text, needle), megabytes_per_second(scalar_search, text, needle),
+               megabytes_per_second(memchr_search, text, needle), megabytes_per_second(memmem_search, text, needle));
+    }
+
+    printf("\n%-22s %12s %12s\n", "MB/s", "count_text", "byte loop");
+    static const char *counts[] = {" ", "fox", "\n"};
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        printf("%-22s %12.0f %12.0f\n", label("count", counts[i]),
+               megabytes_per_second(count_text, text, counts[i]), megabytes_per_second(scalar_count, text, counts[i]));
+    }
+
+    printf("\n%-22s %12s\n", "MB/s", "split_bounds");
+    Value text_value = STRING_CAST(make_objstring(text, TEXT_BYTES));
+    static const char *separators[] = {"\n", ", ", "runs."};
+    for (size_t i = 0; i < sizeof(separators) / sizeof(separators[0]); i++) {
+        printf("%-22s %12.0f\n", label("split", separators[i]), split_megabytes_per_second(text_value, separators[i]));
+    }
+
+    free(text);
+    free_vm();
+    return 0;
+}
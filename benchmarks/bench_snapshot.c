@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+/*
+ * Startup with a large prelude: generates a prelude that defines a number of globals, half of them
+ * strings, and a short script that uses some of them, then times the ways of getting both to run.
+ *
+ *     bench_snapshot <path to filang> [directory for the files, /tmp by default] [globals, 200000 by default]
+ */
+
+#define REPEATS 5
+
+static void generate_prelude(Text *text, int globals) {
+    for (int i = 0; i < globals; i++) {
+        if (i % 2 == 0) {
+            append(text, ":g%d = %d * 3;\n", i, i);
+        } else {
+            append(text, ":g%d = \"value number %d \" + %d;\n", i, i, i);
+        }
+    }
+}
+
+static void generate_script(Text *text, int globals) {
+    append(text, "print g0 + g%d;\n", (globals - 1) & ~1);
+    append(text, "print g1 + \" and \" + g%d;\n", globals / 2 | 1);
+    append(text, ":total = 0;\n");
+    for (int i = 0; i < 100 && i < globals; i += 2) {
+        append(text, "total = total + g%d;\n", i);
+    }
+    append(text, "print total;\n");
+}
+
+static void print_row(const char *name, double seconds) {
+    printf("%-34s %10.1f\n", name, seconds * 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench_snapshot <filang> [directory] [globals]\n");
+        return 1;
+    }
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    int globals = argc > 3 ? atoi(argv[3]) : 200000;
+    if (globals < 2) globals = 2;
+
+    Text prelude = {NULL, 0, 0};
+    Text script = {NULL, 0, 0};
+    generate_prelude(&prelude, globals);
+    generate_script(&script, globals);
+
+    // the prelude with the script appended, what running without a snapshot means
+    Text both = {NULL, 0, 0};
+    append(&both, "%s%s", prelude.chars, script.chars);
+
+    char prelude_path[4096], script_path[4096], both_path[4096], bytecode_path[4096], snapshot_path[4096];
+    snprintf(prelude_path, sizeof(prelude_path), "%s/filang_prelude.fi", directory);
+    snprintf(script_path, sizeof(script_path), "%s/filang_prelude_script.fi", directory);
+    snprintf(both_path, sizeof(both_path), "%s/filang_prelude_both.fi", directory);
+    snprintf(bytecode_path, sizeof(bytecode_path), "%s/filang_prelude_both.fic", directory);
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/filang_prelude.fis", directory);
+
+    if (!write_file(prelude_path, &prelude) || !write_file(script_path, &script) || !write_file(both_path, &both)) {
+        fprintf(stderr, "Could not write the scripts to %s\n", directory);
+        return 1;
+    }
+
+    char *cold[] = {argv[1], "--no-cache", both_path, NULL};
+    char *emit[] = {argv[1], "--emit", bytecode_path, both_path, NULL};
+    char *compiled[] = {argv[1], bytecode_path, NULL};
+    char *snapshot[] = {argv[1], "--no-cache", "--snapshot", snapshot_path, prelude_path, NULL};
+    char *restore[] = {argv[1], "--restore", snapshot_path, script_path, NULL};
+
+    printf("%d globals, a %zu byte prelude\n", globals, prelude.length);
+    printf("%-34s %10s\n", "startup", "ms");
+
+    double seconds = best_run(cold, REPEATS);
+    if (seconds < 0) {
+        fprintf(stderr, "Running %s failed\n", both_path);
+        return 1;
+    }
+    print_row("prelude run from source", seconds);
+
+    if (best_run(emit, 1) < 0 || (seconds = best_run(compiled, REPEATS)) < 0) {
+        fprintf(stderr, "Running %s failed\n", bytecode_path);
+        return 1;
+    }
+    print_row("prelude run from compiled .fic", seconds);
+
+    if ((seconds = best_run(snapshot, 1)) < 0) {
+        fprintf(stderr, "Writing %s failed\n", snapshot_path);
+        return 1;
+    }
+    print_row("--snapshot of the prelude, once", seconds);
+
+    if ((seconds = best_run(restore, REPEATS)) < 0) {
+        fprintf(stderr, "Restoring %s failed\n", snapshot_path);
+        return 1;
+    }
+    print_row("--restore of the snapshot", seconds);
+
+    free_text(&prelude);
+    free_text(&script);
+    free_text(&both);
+    return 0;
+}
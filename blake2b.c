@@ -0,0 +1,100 @@
+#include <stdbool.h>
+#include <string.h>
+#include "blake2b.h"
+
+/*
+ * BLAKE2b as specified by RFC 7693, without a key. Data is compressed 128 bytes at a time, the last
+ * block, padded with zeros, is compressed with the final flag set even when the data is empty.
+ */
+#define BLOCK_SIZE 128
+#define ROUNDS 12
+
+static const uint64_t iv[8] = {
+        0x6A09E667F3BCC908u, 0xBB67AE8584CAA73Bu, 0x3C6EF372FE94F82Bu, 0xA54FF53A5F1D36F1u,
+        0x510E527FADE682D1u, 0x9B05688C2B3E6C1Fu, 0x1F83D9ABFB41BD6Bu, 0x5BE0CD19137E2179u,
+};
+
+static const uint8_t sigma[ROUNDS][16] = {
+        {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15},
+        {14, 10, 4,  8,  9,  15, 13, 6,  1,  12, 0,  2,  11, 7,  5,  3},
+        {11, 8,  12, 0,  5,  2,  15, 13, 10, 14, 3,  6,  7,  1,  9,  4},
+        {7,  9,  3,  1,  13, 12, 11, 14, 2,  6,  5,  10, 4,  0,  15, 8},
+        {9,  0,  5,  7,  2,  4,  10, 15, 14, 1,  11, 12, 6,  8,  3,  13},
+        {2,  12, 6,  10, 0,  11, 8,  3,  4,  13, 7,  5,  15, 14, 1,  9},
+        {12, 5,  1,  15, 14, 13, 4,  10, 0,  7,  6,  3,  9,  2,  8,  11},
+        {13, 11, 7,  14, 12, 1,  3,  9,  5,  0,  15, 4,  8,  6,  2,  10},
+        {6,  15, 14, 9,  11, 3,  0,  8,  12, 2,  13, 7,  1,  4,  10, 5},
+        {10, 2,  8,  4,  7,  6,  1,  5,  15, 11, 9,  14, 3,  12, 13, 0},
+        {0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15},
+        {14, 10, 4,  8,  9,  15, 13, 6,  1,  12, 0,  2,  11, 7,  5,  3},
+};
+
+static inline uint64_t rotate(uint64_t x, int bits) {
+    return (x >> bits) | (x << (64 - bits));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t word = 0;
+    for (int i = 7; i >= 0; i--) {
+        word = (word << 8) | p[i];
+    }
+    return word;
+}
+
+#define MIX(a, b, c, d, x, y) do {              \
+        a += b + (x); d = rotate(d ^ a, 32);    \
+        c += d;       b = rotate(b ^ c, 24);    \
+        a += b + (y); d = rotate(d ^ a, 16);    \
+        c += d;       b = rotate(b ^ c, 63);    \
+    } while (false)
+
+// counter is the number of bytes hashed so far, this block included
+static void compress(uint64_t h[8], const uint8_t *block, uint64_t counter, bool last) {
+    uint64_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = read64(block + 8 * i);
+    }
+
+    uint64_t v[16];
+    memcpy(v, h, sizeof(v[0]) * 8);
+    memcpy(v + 8, iv, sizeof(iv));
+    v[12] ^= counter;
+    if (last) v[14] = ~v[14];
+
+    for (int round = 0; round < ROUNDS; round++) {
+        const uint8_t *s = sigma[round];
+        MIX(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        MIX(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        MIX(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        MIX(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        MIX(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        MIX(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        MIX(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        MIX(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+void blake2b(const void *data, size_t length, uint8_t *digest, size_t digest_size) {
+    const uint8_t *bytes = data;
+    uint64_t h[8];
+    memcpy(h, iv, sizeof(iv));
+    // parameter block: digest length, no key, fanout and depth of 1
+    h[0] ^= 0x01010000u ^ digest_size;
+
+    size_t offset = 0;
+    for (; length - offset > BLOCK_SIZE; offset += BLOCK_SIZE) {
+        compress(h, bytes + offset, offset + BLOCK_SIZE, false);
+    }
+
+    uint8_t last[BLOCK_SIZE] = {0};
+    if (length > offset) memcpy(last, bytes + offset, length - offset);
+    compress(h, last, length, true);
+
+    for (size_t i = 0; i < digest_size; i++) {
+        digest[i] = (uint8_t) (h[i / 8] >> (8 * (i % 8)));
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef FILANG_BLAKE2B_H
+#define FILANG_BLAKE2B_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE2B_MAX_DIGEST 64
+
+// unkeyed BLAKE2b (RFC 7693) of data, digest_size bytes of it, from 1 up to BLAKE2B_MAX_DIGEST, into digest
+void blake2b(const void *data, size_t length, uint8_t *digest, size_t digest_size);
+
+#endif //FILANG_BLAKE2B_H
@@ -0,0 +1,380 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bytecode.h"
+#include "blake2b.h"
+#include "strings.h"
+#include "memory.h"
+#include "vm.h"
+
+#define BYTECODE_MAGIC "FIC"
+#define BYTE_ORDER_MARK 0x01020304u
+#define ALIGN(offset) (((offset) + 7) & ~(size_t) 7)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t value_size;    // files are only read back with the Value layout they were written with
+    uint32_t byte_order;
+    uint8_t source_digest[SOURCE_DIGEST_SIZE];
+    uint64_t source_length;
+    uint32_t segment_count;
+    uint32_t reserved;
+    uint64_t hash_seed;     // the strings were hashed with it
+} FileHeader;
+
+typedef struct {
+    uint64_t size;          // whole segment, header included
+    uint32_t code_length;
+    uint32_t line_bytes;
+    uint32_t line_records;
+    uint32_t constant_count;
+    uint64_t strings_offset;
+} SegmentHeader;
+
+/*
+ * Strings follow the constants, each one preceded by a slot that holds its interned copy once the
+ * first constant referring to it has been patched. String constants hold the offset of their slot.
+ */
+typedef struct {
+    uint64_t interned;
+    ObjString string;
+} StringRecord;
+
+typedef struct {
+    size_t code;
+    size_t lines;
+    size_t checkpoints;
+    size_t constants;
+    size_t strings;
+} SegmentLayout;
+
+static size_t checkpoint_count(uint32_t line_records) {
+    return ((size_t) line_records + LINE_CHECKPOINT_INTERVAL - 1) / LINE_CHECKPOINT_INTERVAL;
+}
+
+static SegmentLayout segment_layout(uint32_t code_length, uint32_t line_bytes, uint32_t line_records,
+                                    uint32_t constant_count) {
+    SegmentLayout layout;
+    layout.code = sizeof(SegmentHeader);
+    layout.lines = layout.code + code_length;
+    layout.checkpoints = ALIGN(layout.lines + line_bytes);
+    layout.constants = ALIGN(layout.checkpoints + sizeof(LineCheckpoint) * checkpoint_count(line_records));
+    layout.strings = layout.constants + sizeof(Value) * (size_t) constant_count;
+    return layout;
+}
+
+#define RECORD_HEADER offsetof(StringRecord, string.chars)
+
+static size_t record_size(int length) {
+    return ALIGN(RECORD_HEADER + (size_t) length + 1);
+}
+
+void digest_source(const char *chars, size_t length, uint8_t digest[SOURCE_DIGEST_SIZE]) {
+    blake2b(chars, length, digest, SOURCE_DIGEST_SIZE);
+}
+
+static void write_padding(BytecodeWriter *writer, size_t from, size_t to) {
+    static const char zeros[8] = {0};
+    if (to > from && fwrite(zeros, 1, to - from, writer->file) != to - from) writer->failed = true;
+}
+
+static void write_bytes(BytecodeWriter *writer, const void *bytes, size_t size) {
+    if (size > 0 && fwrite(bytes, 1, size, writer->file) != size) writer->failed = true;
+}
+
+static void write_file_header(BytecodeWriter *writer) {
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+    header.version = BYTECODE_VERSION;
+    header.value_size = sizeof(Value);
+    header.byte_order = BYTE_ORDER_MARK;
+    memcpy(header.source_digest, writer->source_digest, SOURCE_DIGEST_SIZE);
+    header.source_length = writer->source_length;
+    header.segment_count = writer->segment_count;
+    header.hash_seed = hash_seed;
+
+    write_bytes(writer, &header, sizeof(header));
+}
+
+// threads of --compile-all may write the same path at once, for two scripts that are the same
+static atomic_uint writers_opened;
+
+bool open_bytecode_writer(BytecodeWriter *writer, const char *path, const uint8_t source_digest[SOURCE_DIGEST_SIZE],
+                          size_t source_length) {
+    writer->path = strdup(path);
+    writer->temp_path = malloc(strlen(path) + 48);
+    sprintf(writer->temp_path, "%s.%ld.%u.tmp", path, (long) getpid(), atomic_fetch_add(&writers_opened, 1));
+    memcpy(writer->source_digest, source_digest, SOURCE_DIGEST_SIZE);
+    writer->source_length = source_length;
+    writer->segment_count = 0;
+    writer->failed = false;
+
+    writer->file = fopen(writer->temp_path, "wb");
+    if (writer->file == NULL) {
+        free(writer->path);
+        free(writer->temp_path);
+        return false;
+    }
+
+    // rewritten with the final segment count on close
+    write_file_header(writer);
+    return true;
+}
+
+bool write_bytecode_segment(BytecodeWriter *writer, Chunk *chunk) {
+    if (writer->failed) return false;
+
+    Lines *lines = &chunk->lines;
+    SegmentLayout layout = segment_layout(chunk->count, lines->count, lines->records, chunk->constants.count);
+
+    // each distinct string is stored once per segment, however many constants refer to it
+    init_hashmap(&writer->offsets);
+    size_t size = layout.strings;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant) && get_entry(&writer->offsets, constant) == NULL) {
+            add_entry(&writer->offsets, constant, NEW_INTEGER(size));
+            size += record_size(AS_STRING(constant)->length);
+        }
+    }
+
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size = size;
+    header.code_length = chunk->count;
+    header.line_bytes = lines->count;
+    header.line_records = lines->records;
+    header.constant_count = chunk->constants.count;
+    header.strings_offset = layout.strings;
+
+    write_bytes(writer, &header, sizeof(header));
+    write_bytes(writer, chunk->code, chunk->count);
+    write_bytes(writer, lines->bytes, lines->count);
+    write_padding(writer, layout.lines + lines->count, layout.checkpoints);
+    write_bytes(writer, lines->checkpoints, sizeof(LineCheckpoint) * (size_t) lines->checkpoint_count);
+    write_padding(writer, layout.checkpoints + sizeof(LineCheckpoint) * (size_t) lines->checkpoint_count,
+                  layout.constants);
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant;
+        memset(&constant, 0, sizeof(constant));
+        constant.type = chunk->constants.values[i].type;
+        constant.as = chunk->constants.values[i].as;
+
+        if (IS_STRING(constant)) {
+            constant.as.object = (Object *) (uintptr_t) get_entry(&writer->offsets, constant)->value.as.integer;
+        }
+        write_bytes(writer, &constant, sizeof(constant));
+    }
+
+    // the records go out in the order their offsets were handed out
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (!IS_STRING(constant)) continue;
+
+        Entry *entry = get_entry(&writer->offsets, constant);
+        if (IS_NIL(entry->value)) continue;
+        entry->value = NIL;
+
+        ObjString *string = AS_STRING(constant);
+        StringRecord record;
+        memset(&record, 0, sizeof(record));
+        record.string.object.type = OBJ_STRING;
+        record.string.object.external = true;
+        record.string.length = string->length;
+        record.string.hash = string->hash;
+
+        write_bytes(writer, &record, RECORD_HEADER);
+        write_bytes(writer, string->chars, (size_t) string->length);
+        write_padding(writer, RECORD_HEADER + (size_t) string->length, record_size(string->length));
+    }
+
+    free_hashmap(&writer->offsets);
+    writer->segment_count++;
+    return !writer->failed;
+}
+
+bool close_bytecode_writer(BytecodeWriter *writer, bool keep) {
+    if (keep && !writer->failed) {
+        rewind(writer->file);
+        write_file_header(writer);
+    }
+
+    if (fclose(writer->file) != 0) writer->failed = true;
+
+    bool written = keep && !writer->failed && rename(writer->temp_path, writer->path) == 0;
+    if (!written) unlink(writer->temp_path);
+
+    free(writer->path);
+    free(writer->temp_path);
+    return written || !keep;
+}
+
+bool load_bytecode(const char *path, Bytecode *bytecode) {
+    bytecode->mapping = NULL;
+
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) return false;
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || (size_t) info.st_size < sizeof(FileHeader)) {
+        close(descriptor);
+        return false;
+    }
+
+    // private and writable, so that patching string constants only copies the pages they are on
+    bytecode->size = (size_t) info.st_size;
+    bytecode->mapping = mmap(NULL, bytecode->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (bytecode->mapping == MAP_FAILED) {
+        bytecode->mapping = NULL;
+        return false;
+    }
+
+    FileHeader *header = (FileHeader *) bytecode->mapping;
+    if (memcmp(header->magic, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) != 0 || header->version != BYTECODE_VERSION ||
+        header->value_size != sizeof(Value) || header->byte_order != BYTE_ORDER_MARK) {
+        unload_bytecode(bytecode);
+        return false;
+    }
+
+    // the seed is never taken from a bytecode file, whoever wrote it could pick keys that collide under it
+    bytecode->rehash = header->hash_seed != hash_seed;
+
+    memcpy(bytecode->source_digest, header->source_digest, SOURCE_DIGEST_SIZE);
+    bytecode->source_length = header->source_length;
+    bytecode->segment_count = header->segment_count;
+    bytecode->segment = 0;
+    bytecode->next = sizeof(FileHeader);
+    bytecode->released = 0;
+    return true;
+}
+
+static Value resolve_string(uint8_t *segment, const SegmentHeader *header, Value constant, bool rehash,
+                            bool *valid) {
+    uint64_t offset = (uintptr_t) constant.as.object;
+    if (offset < header->strings_offset || offset > header->size - RECORD_HEADER || offset % 8 != 0) {
+        *valid = false;
+        return NIL;
+    }
+
+    StringRecord *record = (StringRecord *) (segment + offset);
+    if (record->interned == 0) {
+        if (record->string.object.type != OBJ_STRING || !record->string.object.external || record->string.length < 0 ||
+            (uint64_t) record->string.length >= header->size - offset - RECORD_HEADER) {
+            *valid = false;
+            return NIL;
+        }
+
+        if (rehash) record->string.hash = hash_string(record->string.chars, record->string.length);
+        record->interned = (uintptr_t) intern_external_string(&record->string);
+    }
+
+    return NEW_OBJECT((ObjString *) (uintptr_t) record->interned);
+}
+
+bool next_bytecode_segment(Bytecode *bytecode, Chunk *chunk) {
+    if (bytecode->segment >= bytecode->segment_count || bytecode->next + sizeof(SegmentHeader) > bytecode->size) {
+        return false;
+    }
+
+    /*
+     * Segments already run are not needed, interned strings in them read back the same from the file.
+     * Strings hashed again would not, so their pages are kept.
+     */
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t release = bytecode->next & ~(page_size - 1);
+    if (release > bytecode->released && !bytecode->rehash) {
+        madvise(bytecode->mapping + bytecode->released, release - bytecode->released, MADV_DONTNEED);
+        bytecode->released = release;
+    }
+
+    uint8_t *segment = bytecode->mapping + bytecode->next;
+    SegmentHeader *header = (SegmentHeader *) segment;
+    SegmentLayout layout = segment_layout(header->code_length, header->line_bytes, header->line_records,
+                                          header->constant_count);
+
+    if (header->size > bytecode->size - bytecode->next || header->strings_offset != layout.strings ||
+        layout.strings > header->size) {
+        return false;
+    }
+
+    chunk->code = segment + layout.code;
+    chunk->count = (int) header->code_length;
+    chunk->capacity = chunk->count;
+    init_lines(&chunk->lines);
+    chunk->lines.bytes = segment + layout.lines;
+    chunk->lines.count = (int) header->line_bytes;
+    chunk->lines.capacity = chunk->lines.count;
+    chunk->lines.checkpoints = (LineCheckpoint *) (segment + layout.checkpoints);
+    chunk->lines.checkpoint_count = (int) checkpoint_count(header->line_records);
+    chunk->lines.checkpoint_capacity = chunk->lines.checkpoint_count;
+    chunk->lines.records = (int) header->line_records;
+    chunk->constants.count = (int) header->constant_count;
+    chunk->constants.capacity = chunk->constants.count;
+    chunk->constants.values = (Value *) (segment + layout.constants);
+
+    bool valid = true;
+    for (int i = 0; i < chunk->constants.count && valid; i++) {
+        Value *constant = &chunk->constants.values[i];
+        if (IS_OBJECT(*constant)) *constant = resolve_string(segment, header, *constant, bytecode->rehash, &valid);
+        if (IS_SHORT_STRING(*constant)) valid = VALID_SHORT_STRING(*constant);
+    }
+
+    bytecode->segment++;
+    bytecode->next += header->size;
+    return valid;
+}
+
+void unload_bytecode(Bytecode *bytecode) {
+    munmap(bytecode->mapping, bytecode->size);
+    bytecode->mapping = NULL;
+    bytecode->size = 0;
+}
+
+bool is_bytecode_file(const char *path) {
+    size_t length = strlen(path);
+    return length > 4 && strcmp(path + length - 4, ".fic") == 0;
+}
+
+char *bytecode_cache_path(const uint8_t source_digest[SOURCE_DIGEST_SIZE]) {
+    const char *directory = getenv("FILANG_CACHE_DIR");
+    char base[4096];
+
+    if (directory == NULL) {
+        const char *cache_home = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+
+        if (cache_home != NULL && cache_home[0] != '\0') {
+            snprintf(base, sizeof(base), "%s/filang", cache_home);
+        } else if (home != NULL && home[0] != '\0') {
+            snprintf(base, sizeof(base), "%s/.cache", home);
+            mkdir(base, 0755);
+            snprintf(base, sizeof(base), "%s/.cache/filang", home);
+        } else {
+            return NULL;
+        }
+
+        directory = base;
+    }
+
+    mkdir(directory, 0755);
+
+    struct stat info;
+    if (stat(directory, &info) != 0 || !S_ISDIR(info.st_mode)) return NULL;
+
+    char *path = malloc(strlen(directory) + 2 * SOURCE_DIGEST_SIZE + 8);
+    char *end = path + sprintf(path, "%s/", directory);
+    for (int i = 0; i < SOURCE_DIGEST_SIZE; i++) {
+        end += sprintf(end, "%02x", source_digest[i]);
+    }
+    strcpy(end, ".fic");
+    return path;
+}
@@ -0,0 +1,72 @@
+#ifndef FILANG_BYTECODE_H
+#define FILANG_BYTECODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chunk.h"
+#include "hashmap.h"
+
+/*
+ * .fic files hold the compiled segments of a script, each one laid out the way a Chunk is in memory:
+ * code, line table, constants as Values and the strings they refer to as ObjStrings. A loaded file
+ * is used in place from a private mapping, only string constants are patched to their interned copies.
+ */
+#define BYTECODE_VERSION 9
+
+// BLAKE2b-256 of the source a file was compiled from, cached bytecode is only used for an identical one
+#define SOURCE_DIGEST_SIZE 32
+
+typedef struct {
+    FILE *file;
+    char *path;
+    char *temp_path;        // written to first, renamed to path once complete
+    uint8_t source_digest[SOURCE_DIGEST_SIZE];
+    uint64_t source_length;
+    uint32_t segment_count;
+    Hashmap offsets;        // string constant already written -> its offset in the segment
+    bool failed;
+} BytecodeWriter;
+
+typedef struct {
+    uint8_t *mapping;
+    size_t size;
+    uint8_t source_digest[SOURCE_DIGEST_SIZE];
+    uint64_t source_length;
+    uint32_t segment_count;
+    uint32_t segment;       // next segment to hand out
+    size_t next;            // offset of that segment
+    size_t released;        // pages before this offset have been dropped
+    bool rehash;            // written with another hash seed than the VM's, so its strings are hashed again
+} Bytecode;
+
+void digest_source(const char *chars, size_t length, uint8_t digest[SOURCE_DIGEST_SIZE]);
+
+bool open_bytecode_writer(BytecodeWriter *writer, const char *path, const uint8_t source_digest[SOURCE_DIGEST_SIZE],
+                          size_t source_length);
+
+bool write_bytecode_segment(BytecodeWriter *writer, Chunk *chunk);
+
+// completes the file when keep is true, otherwise discards it; returns false if it could not be written
+bool close_bytecode_writer(BytecodeWriter *writer, bool keep);
+
+bool load_bytecode(const char *path, Bytecode *bytecode);
+
+/*
+ * Points chunk at the next segment of the mapping, interning its string constants.
+ * The chunk must not be freed, its memory belongs to the mapping, and it is only valid
+ * until the following segment is loaded.
+ */
+bool next_bytecode_segment(Bytecode *bytecode, Chunk *chunk);
+
+void unload_bytecode(Bytecode *bytecode);
+
+bool is_bytecode_file(const char *path);
+
+// smaller scripts compile faster than a cached copy is looked up
+#define CACHE_MIN_BYTES (1 << 16)
+
+// path of the cached bytecode for a source with this digest, NULL if there is no usable cache directory
+char *bytecode_cache_path(const uint8_t source_digest[SOURCE_DIGEST_SIZE]);
+
+#endif //FILANG_BYTECODE_H
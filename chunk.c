@@ -5,52 +5,207 @@
 #include "memory.h"
 
 
+void init_lines(Lines *lines) {
+    lines->bytes = NULL;
+    lines->count = 0;
+    lines->capacity = 0;
+    lines->checkpoints = NULL;
+    lines->checkpoint_count = 0;
+    lines->checkpoint_capacity = 0;
+    lines->records = 0;
+    lines->last = (LinePosition) {0, 0, 0};
+}
+
+static void free_lines(Lines *lines) {
+    FREE_ARRAY(lines->bytes, uint8_t, lines->capacity, MEMORY_LINES);
+    FREE_ARRAY(lines->checkpoints, LineCheckpoint, lines->checkpoint_capacity, MEMORY_LINES);
+    init_lines(lines);
+}
+
 void init_chunk(Chunk *chunk) {
     chunk->code = NULL;
     chunk->capacity = 0;
     chunk->count = 0;
-    chunk->lines.ends = NULL;
-    chunk->lines.capacity = 0;
-    chunk->lines.count = 0;
-
+    init_lines(&chunk->lines);
     init_value_array(&chunk->constants);
 }
 
 void free_chunk(Chunk *chunk) {
-    FREE_ARRAY(chunk->code, uint8_t, chunk->capacity);
-    FREE_ARRAY(chunk->lines.ends, int, chunk->capacity);
+    FREE_ARRAY(chunk->code, uint8_t, chunk->capacity, MEMORY_CODE);
+    free_lines(&chunk->lines);
     free_value_array(&chunk->constants);
     init_chunk(chunk);
 }
 
-void write_chunk(Chunk *chunk, uint8_t byte, int line) {
+static void write_line_byte(Lines *lines, uint8_t byte) {
+    if (lines->count + 1 > lines->capacity) {
+        int old_capacity = lines->capacity;
+        lines->capacity = GROW_ARRAY_CAPACITY(lines->capacity);
+        lines->bytes = GROW_ARRAY(lines->bytes, uint8_t, old_capacity, lines->capacity, MEMORY_LINES);
+    }
+
+    lines->bytes[lines->count++] = byte;
+}
+
+static void write_varint(Lines *lines, uint32_t value) {
+    while (value >= 0x80) {
+        write_line_byte(lines, (uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    write_line_byte(lines, (uint8_t) value);
+}
+
+static uint32_t read_varint(const uint8_t *bytes, int *index) {
+    uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = bytes[(*index)++];
+        value |= (uint32_t) (byte & 0x7F) << shift;
+        if (byte < 0x80) return value;
+    }
+}
+
+/*
+ * A record staying on the same line and moving 1 to 4 bytes and -16 to 15 columns is the single byte
+ * 1ooccccc, one moving to the next line and 1 to 64 bytes is 01oooooo followed by the column. Any other
+ * is a 0 byte followed by the offset difference, the line difference zigzag encoded and the column.
+ * Numbers after the first byte are varints.
+ */
+static void add_line(Lines *lines, LinePosition position) {
+    if (lines->records % LINE_CHECKPOINT_INTERVAL == 0) {
+        if (lines->checkpoint_count + 1 > lines->checkpoint_capacity) {
+            int old_capacity = lines->checkpoint_capacity;
+            lines->checkpoint_capacity = GROW_ARRAY_CAPACITY(lines->checkpoint_capacity);
+            lines->checkpoints = GROW_ARRAY(lines->checkpoints, LineCheckpoint, old_capacity,
+                                            lines->checkpoint_capacity, MEMORY_LINES);
+        }
+        lines->checkpoints[lines->checkpoint_count++] = (LineCheckpoint) {position, lines->count};
+    } else {
+        int offset = position.offset - lines->last.offset;
+        int line = position.line - lines->last.line;
+        int column = position.column - lines->last.column;
+
+        if (line == 0 && offset >= 1 && offset <= 4 && column >= -16 && column <= 15) {
+            write_line_byte(lines, (uint8_t) (0x80 | (offset - 1) << 5 | (column & 0x1F)));
+        } else if (line == 1 && offset >= 1 && offset <= 64) {
+            write_line_byte(lines, (uint8_t) (0x40 | (offset - 1)));
+            write_varint(lines, (uint32_t) position.column);
+        } else {
+            write_line_byte(lines, 0);
+            write_varint(lines, (uint32_t) offset);
+            write_varint(lines, ((uint32_t) line << 1) ^ (uint32_t) (line >> 31));
+            write_varint(lines, (uint32_t) position.column);
+        }
+    }
+
+    lines->records++;
+    lines->last = position;
+}
+
+static LinePosition read_line(const uint8_t *bytes, int *index, LinePosition previous) {
+    uint8_t byte = bytes[(*index)++];
+    if (byte & 0x80) {
+        int column = ((byte & 0x1F) ^ 0x10) - 0x10;
+        return (LinePosition) {previous.offset + ((byte >> 5) & 0x03) + 1, previous.line, previous.column + column};
+    }
+    if (byte & 0x40) {
+        return (LinePosition) {previous.offset + (byte & 0x3F) + 1, previous.line + 1, (int) read_varint(bytes, index)};
+    }
+
+    int offset = (int) read_varint(bytes, index);
+    uint32_t line = read_varint(bytes, index);
+    int column = (int) read_varint(bytes, index);
+    return (LinePosition) {previous.offset + offset, previous.line + (int) ((line >> 1) ^ -(line & 1)), column};
+}
+
+LinePosition find_line(const Lines *lines, int offset) {
+    if (lines->checkpoint_count == 0) return (LinePosition) {0, 0, 0};
+
+    // last checkpoint at or before offset
+    int low = 0, high = lines->checkpoint_count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (lines->checkpoints[mid].position.offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    LinePosition found = lines->checkpoints[low].position;
+    int index = lines->checkpoints[low].next;
+    int end = low + 1 < lines->checkpoint_count ? lines->checkpoints[low + 1].next : lines->count;
+
+    while (index < end) {
+        LinePosition position = read_line(lines->bytes, &index, found);
+        if (position.offset > offset) break;
+        found = position;
+    }
+
+    return found;
+}
+
+// offsets only get closer together, so each record is rewritten in place in the bytes it already takes
+static void relocate_records(Lines *lines, int checkpoint, relocate_fn relocate, void *context) {
+    LinePosition position = lines->checkpoints[checkpoint].position;
+    int relocated = relocate(context, position.offset);
+    int index = lines->checkpoints[checkpoint].next;
+    int end = checkpoint + 1 < lines->checkpoint_count ? lines->checkpoints[checkpoint + 1].next : lines->count;
+
+    while (index < end) {
+        uint8_t *bytes = &lines->bytes[index];
+        int offset = position.offset;
+        position = read_line(lines->bytes, &index, position);
+
+        int moved = relocate(context, position.offset);
+        int distance = moved - relocated;
+        relocated = moved;
+        if (distance == position.offset - offset) continue;
+
+        if (bytes[0] & 0x80) {
+            bytes[0] = (uint8_t) ((bytes[0] & 0x9F) | (distance - 1) << 5);
+        } else if (bytes[0] & 0x40) {
+            bytes[0] = (uint8_t) (0x40 | (distance - 1));
+        } else {
+            // a shorter distance is padded to the length of the varint it replaces
+            int last = 1;
+            while (bytes[last] & 0x80) last++;
+            for (int at = 1; at <= last; at++) {
+                bytes[at] = (uint8_t) ((distance & 0x7F) | (at < last ? 0x80 : 0));
+                distance >>= 7;
+            }
+        }
+    }
+}
+
+void relocate_lines(Lines *lines, relocate_fn relocate, void *context) {
+    for (int i = 0; i < lines->checkpoint_count; i++) {
+        int start = lines->checkpoints[i].position.offset;
+        int end = i + 1 < lines->checkpoint_count ? lines->checkpoints[i + 1].position.offset : lines->last.offset;
+        int moved = relocate(context, start);
+
+        // records between two checkpoints that stay as far apart as before all keep their distances
+        if (relocate(context, end) - moved != end - start) relocate_records(lines, i, relocate, context);
+        lines->checkpoints[i].position.offset = moved;
+    }
+
+    lines->last.offset = relocate(context, lines->last.offset);
+}
+
+void write_chunk(Chunk *chunk, uint8_t byte, int line, int column) {
     if (chunk->count + 1 >= chunk->capacity) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_ARRAY_CAPACITY(chunk->capacity);
-        chunk->code = GROW_ARRAY(chunk->code, uint8_t, oldCapacity, chunk->capacity);
-        if (chunk->code == NULL) {
-            fprintf(stderr, "Failed to allocate memory\n");
-            exit(1);
-        }
+        chunk->code = GROW_ARRAY(chunk->code, uint8_t, oldCapacity, chunk->capacity, MEMORY_CODE);
     }
 
     chunk->code[chunk->count] = byte;
 
-    if (line > chunk->lines.count) {
-        if (chunk->lines.count + 1 >= chunk->lines.capacity) {
-            int oldCapacity = chunk->lines.capacity;
-            chunk->lines.capacity = GROW_ARRAY_CAPACITY(chunk->lines.capacity);
-            chunk->lines.ends = GROW_ARRAY(chunk->lines.ends, int, oldCapacity, chunk->lines.capacity);
-            if (chunk->lines.ends == NULL) {
-                fprintf(stderr, "Failed to allocate memory\n");
-                exit(1);
-            }
-            memset(&chunk->lines.ends[oldCapacity], -1, sizeof(int) * (chunk->lines.capacity - oldCapacity));
-        }
-         chunk->lines.count++;
+    // bytes coming from the same token share a record
+    Lines *lines = &chunk->lines;
+    if (lines->records == 0 || lines->last.line != line || lines->last.column != column) {
+        add_line(lines, (LinePosition) {chunk->count, line, column});
     }
 
-    chunk->lines.ends[line-1] = chunk->count;
     chunk->count++;
 }
 
@@ -10,6 +10,7 @@ typedef enum {
     OP_ERROR,
     OP_RETURN,
     OP_ADD,
+    OP_CONCAT_N,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
@@ -42,16 +43,50 @@ typedef enum {
     OP_SET_GLOBAL,
     OP_GET_LOCAL,
     OP_SET_LOCAL,
+    OP_DEFINE_LOCAL,
     OP_CLOCK,
     OP_TYPEOF,
+    OP_IMPORT,
+    OP_INDEX,
+    OP_SLICE,
+    OP_METHOD,
+    // every jump comes in a short (1 byte), standard (2 bytes) and wide (4 bytes) form, in this order
+    OP_JUMP_SHORT,
     OP_JUMP,
+    OP_JUMP_WIDE,
+    OP_JUMP_IF_FALSE_SHORT,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_FALSE_WIDE,
 } OpCode;
 
+#define LINE_CHECKPOINT_INTERVAL 64
+
+typedef struct {
+    int offset;         // first byte of code the position applies to
+    int line;
+    int column;
+} LinePosition;
+
+typedef struct {
+    LinePosition position;
+    int next;           // index in bytes of the record after this one
+} LineCheckpoint;
+
+/*
+ * Source positions of the code, one record each time the token the bytes come from changes. Records
+ * are stored as differences from the previous one, in a single byte when they stay on the same line,
+ * and every LINE_CHECKPOINT_INTERVAL of them is kept whole in checkpoints instead, so that a lookup
+ * binary searches the checkpoints and decodes no more than the records up to the next one.
+ */
 typedef struct {
+    uint8_t *bytes;
     int count;
     int capacity;
-    int *ends;
+    LineCheckpoint *checkpoints;
+    int checkpoint_count;
+    int checkpoint_capacity;
+    int records;
+    LinePosition last;  // the next record is encoded against it
 } Lines;
 
 typedef struct {
@@ -66,8 +101,19 @@ void init_chunk(Chunk *chunk);
 
 void free_chunk(Chunk *chunk);
 
-void write_chunk(Chunk *chunk, uint8_t byte, int line);
+void write_chunk(Chunk *chunk, uint8_t byte, int line, int column);
 
 int write_constant(Chunk *chunk, Value value);
 
+void init_lines(Lines *lines);
+
+// the position of the code at offset, line 0 if the chunk has none
+LinePosition find_line(const Lines *lines, int offset);
+
+typedef int (*relocate_fn)(void *context, int offset);
+
+// passes every offset in lines through relocate, which must keep them strictly
+// increasing and never move two of them further apart
+void relocate_lines(Lines *lines, relocate_fn relocate, void *context);
+
 #endif //FILANG_CHUNK_H
@@ -5,27 +5,82 @@
 #include "compiler.h"
 #include "memory.h"
 #include "scanner.h"
+#include "lexer.h"
 #include "strings.h"
+#include "hashmap.h"
+#include "stats.h"
 
 #define MAX_SCOPE_DEPTH 512
+#define SEGMENT_BYTES (1 << 16)
 
 typedef struct {
     Token previous;
     Token current;
     bool has_error;
     bool panic_mode;
+    int string_end;     // code offset right after the last expression known to produce a string
 } Parser;
 
-struct {
-    Token *variables;
-    size_t count;
-    size_t capacity;
-    size_t current_depth;
-    size_t locals_in_scope[MAX_SCOPE_DEPTH];
-} locals;
+typedef struct {
+    ObjString *name;
+    size_t depth;
+    int shadowed;       // index of the outer local hidden by this one, -1 if none
+} Local;
 
-Parser parser;
-Chunk *compile_chunk;
+typedef struct {
+    int from;           // offset of the jump opcode
+    int to;             // offset of the instruction the jump lands on
+    uint8_t opcode;     // OP_JUMP or OP_JUMP_IF_FALSE
+    int width;          // operand width chosen by relax_jumps()
+} Jump;
+
+/*
+ * Everything a single compilation needs, so that several of them can run at the same time.
+ */
+typedef struct {
+    Parser parser;
+    Scanner scanner;
+    TokenStream *tokens;    // tokens scanned ahead of time, NULL when scanning on demand
+    SourceStream *input;    // source still arriving, NULL when it is all in memory
+    segment_fn run;         // receives each finished segment, NULL when compiling a single chunk
+    bool stopped;           // run asked not to compile any further
+    Chunk *chunk;
+    Hashmap *strings;   // table the identifiers and literals are interned in
+    CompileStats *stats;    // NULL unless the phases are being timed
+
+    /*
+     * Start of the line code was last emitted for, searched back from a token only when the line
+     * changes and never past the end of the token before it.
+     */
+    struct {
+        int line;
+        const char *start;
+        const char *floor;
+    } line_start;
+
+    /*
+     * Scoped symbol table: `variables` is the stack of declared locals, `names` maps
+     * every visible identifier to the index of its innermost declaration.
+     */
+    struct {
+        Local *variables;
+        size_t count;
+        size_t capacity;
+        size_t current_depth;
+        size_t locals_in_scope[MAX_SCOPE_DEPTH];
+        Hashmap names;
+    } locals;
+
+    /*
+     * Jumps are emitted with a 4 byte placeholder operand and recorded here;
+     * once the whole chunk is compiled relax_jumps() picks the smallest encoding for each of them.
+     */
+    struct {
+        Jump *list;
+        int count;
+        int capacity;
+    } jumps;
+} Compiler;
 
 typedef enum {
     PREC_NONE,          // None
@@ -46,7 +101,7 @@ typedef enum {
     PREC_CALL           // . ()
 } ParsePrec;
 
-typedef void (*parse_fn)(bool assignable);
+typedef void (*parse_fn)(Compiler *compiler, bool assignable);
 
 typedef struct {
     parse_fn prefix;
@@ -54,124 +109,213 @@ typedef struct {
     ParsePrec prec;
 } ParseRule;
 
-void init_compiler(Chunk *chunk) {
-    parser.has_error = false;
-    parser.panic_mode = false;
-    compile_chunk = chunk;
-    locals.count = 0;
-    locals.capacity = 0;
-    locals.variables = NULL;
-    locals.current_depth = 0;
-    memset(locals.locals_in_scope, 0, sizeof(int) * 255);
-}
-
-static size_t define_local(Token name, size_t depth) {
-    if (locals.count + 1 >= locals.capacity) {
-        size_t old_capacity = locals.capacity;
-        locals.capacity = GROW_ARRAY_CAPACITY(old_capacity);
-        locals.variables = GROW_ARRAY(locals.variables, Token, old_capacity, locals.capacity);
-
-        if (locals.variables == NULL) {
-            fprintf(stderr, "Failed to allocate memory for local variables\n");
-            exit(1);
-        }
-    }
-    locals.variables[locals.count] = name;
-    locals.locals_in_scope[depth]++;
-    return locals.count++;
+static void init_compiler(Compiler *compiler, Chunk *chunk, const char *source, size_t length, Hashmap *strings,
+                          CompileStats *stats) {
+    init_scanner(&compiler->scanner, source, length);
+    compiler->tokens = NULL;
+    compiler->input = NULL;
+    compiler->run = NULL;
+    compiler->stopped = false;
+    compiler->parser.previous = (Token) {TOKEN_EOF, source, 0, 1};
+    compiler->parser.current = compiler->parser.previous;
+    compiler->parser.has_error = false;
+    compiler->parser.panic_mode = false;
+    compiler->parser.string_end = -1;
+    compiler->chunk = chunk;
+    compiler->strings = strings;
+    compiler->stats = stats;
+    compiler->line_start.line = 1;
+    compiler->line_start.start = source;
+    compiler->line_start.floor = source;
+    compiler->locals.count = 0;
+    compiler->locals.capacity = 0;
+    compiler->locals.variables = NULL;
+    compiler->locals.current_depth = 0;
+    memset(compiler->locals.locals_in_scope, 0, sizeof(compiler->locals.locals_in_scope));
+    init_hashmap(&compiler->locals.names);
+    compiler->jumps.list = NULL;
+    compiler->jumps.count = 0;
+    compiler->jumps.capacity = 0;
 }
 
-static size_t get_local_index(Token name) {
-    for (int i = (int) locals.count - 1; i >= 0; i--) {
-        if (strncmp(name.start, locals.variables[i].start, name.length) == 0) {
-            return i;
-        }
-    }
-
-    return -1;
+static void free_compiler(Compiler *compiler) {
+    FREE_ARRAY(compiler->locals.variables, Local, compiler->locals.capacity, MEMORY_LOCALS);
+    free_hashmap(&compiler->locals.names);
+    FREE_ARRAY(compiler->jumps.list, Jump, compiler->jumps.capacity, MEMORY_TEMPORARY);
 }
 
-static bool local_exists_in_cur_scope(Token local) {
-    for (size_t i = locals.count - locals.locals_in_scope[locals.current_depth]; i < locals.count; i++) {
-        if (strncmp(locals.variables[i].start, local.start, locals.variables[i].length) == 0) {
-            return true;
-        }
+static size_t define_local(Compiler *compiler, ObjString *name, size_t depth) {
+    if (compiler->locals.count + 1 >= compiler->locals.capacity) {
+        size_t old_capacity = compiler->locals.capacity;
+        compiler->locals.capacity = GROW_ARRAY_CAPACITY(old_capacity);
+        compiler->locals.variables = GROW_ARRAY(compiler->locals.variables, Local, old_capacity, compiler->locals.capacity,
+                                                 MEMORY_LOCALS);
     }
 
-    return false;
+    Entry *visible = get_entry(&compiler->locals.names, NEW_OBJECT(name));
+
+    compiler->locals.variables[compiler->locals.count].name = name;
+    compiler->locals.variables[compiler->locals.count].depth = depth;
+    compiler->locals.variables[compiler->locals.count].shadowed = visible != NULL ? (int) visible->value.as.integer : -1;
+    add_entry(&compiler->locals.names, NEW_OBJECT(name), NEW_INTEGER(compiler->locals.count));
+    compiler->locals.locals_in_scope[depth]++;
+    return compiler->locals.count++;
+}
+
+static size_t get_local_index(Compiler *compiler, ObjString *name) {
+    Entry *entry = get_entry(&compiler->locals.names, NEW_OBJECT(name));
+    return entry != NULL ? (size_t) entry->value.as.integer : (size_t) -1;
 }
 
-static void compile_error(Token *token, const char *message) {
-    if (parser.panic_mode) return;
-    parser.panic_mode = true;
-    parser.has_error = true;
+static bool local_exists_in_cur_scope(Compiler *compiler, ObjString *name) {
+    size_t index = get_local_index(compiler, name);
+    return index != (size_t) -1 && compiler->locals.variables[index].depth == compiler->locals.current_depth;
+}
 
-    fprintf(stderr, "[line %d] CompileError", token->line);
+static void compile_error(Compiler *compiler, Token *token, const char *message) {
+    if (compiler->parser.panic_mode) return;
+    compiler->parser.panic_mode = true;
+    compiler->parser.has_error = true;
 
+    // a single write per error, so that concurrent compilations don't interleave their messages
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(stderr, "[line %d] CompileError at end: %s\n", token->line, message);
     } else if (token->type == TOKEN_ERROR) {
+        fprintf(stderr, "[line %d] CompileError: %s\n", token->line, message);
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(stderr, "[line %d] CompileError at '%.*s': %s\n", token->line, token->length, token->start, message);
     }
+}
+
+static ObjString *intern(Compiler *compiler, const char *chars, int length) {
+    if (compiler->stats == NULL) return make_objstring_in(compiler->strings, chars, length);
+
+    double start = now_seconds();
+    ObjString *string = make_objstring_in(compiler->strings, chars, length);
+    compiler->stats->intern_time += now_seconds() - start;
+    return string;
+}
 
-    fprintf(stderr, ": %s\n", message);
+static void error_at_current(Compiler *compiler, const char *message) {
+    compile_error(compiler, &compiler->parser.current, message);
 }
 
-static void error_at_current(const char *message) {
-    compile_error(&parser.current, message);
+static void error_at_previous(Compiler *compiler, const char *message) {
+    compile_error(compiler, &compiler->parser.previous, message);
 }
 
-static void error_at_previous(const char *message) {
-    compile_error(&parser.previous, message);
+static LinePosition token_position(Compiler *compiler, const Token *token) {
+    const char *end = token->start + token->length;
+
+    if (token->line != compiler->line_start.line) {
+        const char *start = end;
+        while (start > compiler->line_start.floor && start[-1] != '\n') start--;
+        compiler->line_start.line = token->line;
+        compiler->line_start.start = start;
+    }
+    if (end > compiler->line_start.floor) compiler->line_start.floor = end;
+
+    // a token spanning several lines is on the last of them
+    int column = token->start >= compiler->line_start.start ? (int) (token->start - compiler->line_start.start) + 1 : 1;
+    return (LinePosition) {0, token->line, column};
 }
 
-static void emit_byte(uint8_t byte) {
-    write_chunk(compile_chunk, byte, parser.previous.line);
+static void emit_byte_at(Compiler *compiler, uint8_t byte, LinePosition position) {
+    write_chunk(compiler->chunk, byte, position.line, position.column);
 }
 
-static void emit_bytes(int count, ...) {
+static void emit_byte(Compiler *compiler, uint8_t byte) {
+    emit_byte_at(compiler, byte, token_position(compiler, &compiler->parser.previous));
+}
+
+static void emit_bytes(Compiler *compiler, int count, ...) {
     va_list args;
     va_start(args, count);
     for (int i = 0; i < count; i++) {
-        emit_byte(va_arg(args, int));
+        emit_byte(compiler, va_arg(args, int));
     }
     va_end(args);
 }
 
-static void emit_constant(Value value) {
-    int index = write_constant(compile_chunk, value);
+static void emit_constant(Compiler *compiler, Value value) {
+    int index = write_constant(compiler->chunk, value);
 
     if (index < 255) {
-        emit_bytes(2, OP_CONSTANT, index);
+        emit_bytes(compiler, 2, OP_CONSTANT, index);
     } else if (index < 65535) {
-        emit_bytes(3, OP_CONSTANT_LONG, index & 0xFF, (index >> 8) & 0xFF);
+        emit_bytes(compiler, 3, OP_CONSTANT_LONG, index & 0xFF, (index >> 8) & 0xFF);
     } else if (index < 16777215) {
-        emit_bytes(4, OP_CONSTANT_LONG_LONG, index & 0xFF, (index >> 8) & 0xFF, (index >> 16) & 0xFF);
+        emit_bytes(compiler, 4, OP_CONSTANT_LONG_LONG, index & 0xFF, (index >> 8) & 0xFF, (index >> 16) & 0xFF);
     } else {
-        error_at_previous("Too many constants in one chunk.");
-        exit(1);
+        error_at_previous(compiler, "Too many constants in one chunk.");
+    }
+}
+
+static bool end_segment(Compiler *compiler);
+
+// a ';' outside any block ends a top-level statement whose code is complete
+static bool at_statement_end(Compiler *compiler) {
+    return compiler->parser.previous.type == TOKEN_SEMICOLON && compiler->locals.current_depth == 0 &&
+           !compiler->parser.has_error && compiler->chunk->count > 0;
+}
+
+/*
+ * A token that reaches the end of the input received so far might go on in the next read,
+ * so it is scanned again once more input has arrived. Before waiting for it the statements
+ * already compiled are handed over, so that they run without waiting on the rest of the input.
+ */
+static Token scan_streamed(Compiler *compiler) {
+    for (;;) {
+        if (compiler->stopped) {
+            compiler->scanner.start = compiler->scanner.current;
+            return (Token) {TOKEN_EOF, compiler->scanner.current, 0, compiler->scanner.line};
+        }
+
+        Scanner saved = compiler->scanner;
+        Token token = scan_token(&compiler->scanner);
+
+        // the scanner looks up to two characters ahead, "1." may still become "1.5"
+        if (compiler->input->finished || compiler->scanner.current + 1 < compiler->scanner.end) return token;
+
+        if (token.type == TOKEN_ERROR) free((char *) token.start);
+        compiler->scanner = saved;
+
+        if (at_statement_end(compiler) && !end_segment(compiler)) continue;
+
+        read_more(compiler->input);
+        compiler->scanner.end = compiler->input->chars + compiler->input->length;
     }
 }
 
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Compiler *compiler) {
+    compiler->parser.previous = compiler->parser.current;
 
     while (true) {
-        parser.current = scan_token();
-        if (parser.current.type != TOKEN_ERROR) break;
-        error_at_current(parser.current.start);
+        if (compiler->stopped && compiler->input == NULL) {
+            // what follows is not compiled, it reads as the end of the input
+            Token *previous = &compiler->parser.previous;
+            compiler->parser.current = (Token) {TOKEN_EOF, previous->start + previous->length, 0, previous->line};
+        } else if (compiler->tokens != NULL) {
+            compiler->parser.current = next_token(compiler->tokens);
+        } else if (compiler->input != NULL) {
+            compiler->parser.current = scan_streamed(compiler);
+        } else {
+            compiler->parser.current = scan_token(&compiler->scanner);
+        }
+
+        if (compiler->parser.current.type != TOKEN_ERROR) break;
+        error_at_current(compiler, compiler->parser.current.start);
     }
 }
 
-static void skip_to_next_statement() {
-    parser.panic_mode = false;
+static void skip_to_next_statement(Compiler *compiler) {
+    compiler->parser.panic_mode = false;
 
-    while (parser.current.type != TOKEN_EOF) {
-        if (parser.previous.type == TOKEN_SEMICOLON)
+    while (compiler->parser.current.type != TOKEN_EOF) {
+        if (compiler->parser.previous.type == TOKEN_SEMICOLON)
             return;
 
-        switch (parser.current.type) {
+        switch (compiler->parser.current.type) {
             case TOKEN_COLONS:
             case TOKEN_PRINT:
             case TOKEN_LEFT_BRACE:
@@ -180,21 +324,21 @@ static void skip_to_next_statement() {
                 break;
         }
 
-        advance();
+        advance(compiler);
     }
 }
 
-static void consume(TokenType expectedType, const char *errorMessage) {
-    if (parser.current.type == expectedType) {
-        advance();
+static void consume(Compiler *compiler, TokenType expectedType, const char *errorMessage) {
+    if (compiler->parser.current.type == expectedType) {
+        advance(compiler);
     } else {
-        error_at_current(errorMessage);
+        error_at_current(compiler, errorMessage);
     }
 }
 
-static bool match(TokenType expectedType) {
-    if (parser.current.type == expectedType) {
-        advance();
+static bool match(Compiler *compiler, TokenType expectedType) {
+    if (compiler->parser.current.type == expectedType) {
+        advance(compiler);
         return true;
     }
     return false;
@@ -204,232 +348,372 @@ static bool match(TokenType expectedType) {
 static ParseRule *get_rule(TokenType type);
 
 
-static void parse_expression(ParsePrec precedence) {
-    advance();
-    parse_fn prefix = get_rule(parser.previous.type)->prefix;
+static void parse_expression(Compiler *compiler, ParsePrec precedence) {
+    advance(compiler);
+    parse_fn prefix = get_rule(compiler->parser.previous.type)->prefix;
 
     if (prefix == NULL) {
-        error_at_previous("expected expression.");
+        error_at_previous(compiler, "expected expression.");
         return;
     }
 
     bool assignable = precedence <= PREC_ASSIGNMENT;
-    prefix(assignable);
+    prefix(compiler, assignable);
 
     ParseRule *rule;
-    while (rule = get_rule(parser.current.type), precedence <= rule->prec) {
+    while (rule = get_rule(compiler->parser.current.type), precedence <= rule->prec) {
         parse_fn infix = rule->infix;
-        advance();
-        infix(assignable);
+        advance(compiler);
+        infix(compiler, assignable);
     }
 
-    if (assignable && match(TOKEN_EQUAL)) {
-        error_at_previous("Invalid assignment target.");
+    if (assignable && match(compiler, TOKEN_EQUAL)) {
+        error_at_previous(compiler, "Invalid assignment target.");
     }
 }
 
 
-static void expression() {
-    parse_expression(PREC_ASSIGNMENT);
+static void expression(Compiler *compiler) {
+    parse_expression(compiler, PREC_ASSIGNMENT);
 }
 
-static void print() {
-    parse_expression(PREC_NONE + 1);
-    emit_byte(OP_PRINT);
+static void print(Compiler *compiler) {
+    parse_expression(compiler, PREC_NONE + 1);
+    emit_byte(compiler, OP_PRINT);
 }
 
-static void end_scope() {
-    locals.count -= locals.locals_in_scope[locals.current_depth];
-    locals.locals_in_scope[locals.current_depth] = 0;
-    locals.current_depth--;
+static void end_scope(Compiler *compiler) {
+    for (size_t i = 0; i < compiler->locals.locals_in_scope[compiler->locals.current_depth]; i++) {
+        Local *local = &compiler->locals.variables[--compiler->locals.count];
+
+        if (local->shadowed != -1) {
+            add_entry(&compiler->locals.names, NEW_OBJECT(local->name), NEW_INTEGER(local->shadowed));
+        } else {
+            erase_entry(&compiler->locals.names, NEW_OBJECT(local->name));
+        }
+    }
+
+    compiler->locals.locals_in_scope[compiler->locals.current_depth] = 0;
+    compiler->locals.current_depth--;
 }
 
-static void start_scope() {
-    locals.current_depth++;
+static void start_scope(Compiler *compiler) {
+    compiler->locals.current_depth++;
 }
 
-static void definition();
+static void definition(Compiler *compiler);
 
-static void block() {
-    start_scope();
+static void block(Compiler *compiler) {
+    start_scope(compiler);
 
-    if (locals.current_depth >= MAX_SCOPE_DEPTH) {
-        error_at_current("too many nested blocks.");
-        exit(1);
+    if (compiler->locals.current_depth >= MAX_SCOPE_DEPTH) {
+        error_at_current(compiler, "too many nested blocks.");
+        compiler->locals.current_depth--;
+        return;
     }
     while (true) {
-        if (match(TOKEN_RIGHT_BRACE)) {
+        if (match(compiler, TOKEN_RIGHT_BRACE)) {
             break;
         }
 
-        if (match(TOKEN_EOF)) {
-            error_at_current("Expected '}' at the end of block.");
+        if (match(compiler, TOKEN_EOF)) {
+            error_at_current(compiler, "Expected '}' at the end of block.");
             break;
         }
 
-        definition();
+        definition(compiler);
+    }
+
+    end_scope(compiler);
+}
+
+static int emit_jump(Compiler *compiler, uint8_t jump) {
+    if (compiler->jumps.count + 1 >= compiler->jumps.capacity) {
+        int old_capacity = compiler->jumps.capacity;
+        compiler->jumps.capacity = GROW_ARRAY_CAPACITY(old_capacity);
+        compiler->jumps.list = GROW_ARRAY(compiler->jumps.list, Jump, old_capacity, compiler->jumps.capacity, MEMORY_TEMPORARY);
+    }
+
+    compiler->jumps.list[compiler->jumps.count].from = compiler->chunk->count;
+    compiler->jumps.list[compiler->jumps.count].to = -1;
+    compiler->jumps.list[compiler->jumps.count].opcode = jump;
+    compiler->jumps.list[compiler->jumps.count].width = 4;
+
+    emit_byte(compiler, jump);
+    emit_bytes(compiler, 4, OP_ERROR, OP_ERROR, OP_ERROR, OP_ERROR); // placeholder for jump offset
+    return compiler->jumps.count++;
+}
+
+static void fix_jump_index(Compiler *compiler, int jump_index) {
+    compiler->jumps.list[jump_index].to = compiler->chunk->count;
+}
+
+/*
+ * Maps an offset of the unrelaxed code to its position once the jumps got their final width,
+ * saved[i] holds how many bytes relaxing the first i jumps removed.
+ */
+static int relaxed_offset(Compiler *compiler, const int *saved, int offset) {
+    int low = 0, high = compiler->jumps.count;
+
+    // first jump starting at or after offset, the jumps are sorted by position
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (compiler->jumps.list[mid].from < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low > 0 && offset > compiler->jumps.list[low - 1].from && offset <= compiler->jumps.list[low - 1].from + 4) {
+        // inside a placeholder operand, clamp to the relaxed operand
+        Jump *jump = &compiler->jumps.list[low - 1];
+        int operand_byte = offset - jump->from < jump->width ? offset - jump->from : jump->width;
+        return jump->from - saved[low - 1] + operand_byte;
     }
 
-    end_scope();
+    return offset - saved[low];
+}
+
+typedef struct {
+    Compiler *compiler;
+    const int *saved;
+} Relaxation;
+
+static int relaxed_line(void *context, int offset) {
+    Relaxation *relaxation = context;
+    return relaxed_offset(relaxation->compiler, relaxation->saved, offset);
 }
 
-static int emit_jump(uint8_t jump) {
-    emit_byte(jump);
-    emit_bytes(2, OP_ERROR, OP_ERROR); // placeholder for jump offset
-    return compile_chunk->count - 2;
+static int jump_width(int offset) {
+    if (offset <= UINT8_MAX) return 1;
+    if (offset <= UINT16_MAX) return 2;
+    return 4;
 }
 
-static void fix_jump_index(int jump_index) {
-    int offset = compile_chunk->count - jump_index - 2;
+static void relax_jumps(Compiler *compiler) {
+    if (compiler->jumps.count == 0) return;
+
+    int *saved = ALLOCATE(int, compiler->jumps.count + 1, MEMORY_TEMPORARY);
+
+    for (int i = 0; i < compiler->jumps.count; i++) {
+        compiler->jumps.list[i].width = 1;
+    }
+
+    // widths only ever grow, so this settles after a few passes
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        saved[0] = 0;
+        for (int i = 0; i < compiler->jumps.count; i++) {
+            saved[i + 1] = saved[i] + 4 - compiler->jumps.list[i].width;
+        }
+
+        for (int i = 0; i < compiler->jumps.count; i++) {
+            Jump *jump = &compiler->jumps.list[i];
+            int offset = relaxed_offset(compiler, saved, jump->to) - (jump->from - saved[i] + 1 + jump->width);
+            int width = jump_width(offset);
+
+            if (width > jump->width) {
+                jump->width = width;
+                changed = true;
+            }
+        }
+    }
+
+    saved[0] = 0;
+    for (int i = 0; i < compiler->jumps.count; i++) {
+        saved[i + 1] = saved[i] + 4 - compiler->jumps.list[i].width;
+    }
+
+    Relaxation relaxation = {compiler, saved};
+    relocate_lines(&compiler->chunk->lines, relaxed_line, &relaxation);
+
+    uint8_t *code = compiler->chunk->code;
+    int write = 0, read = 0;
+
+    for (int i = 0; i < compiler->jumps.count; i++) {
+        Jump *jump = &compiler->jumps.list[i];
+        memmove(code + write, code + read, jump->from - read);
+        write += jump->from - read;
 
-    if (offset > 65535) {
-        error_at_current("jump then_offset too large.");
-        exit(1);
+        int offset = relaxed_offset(compiler, saved, jump->to) - (write + 1 + jump->width);
+        code[write++] = jump->opcode + (jump->width == 1 ? -1 : jump->width == 4 ? 1 : 0);
+        for (int byte = 0; byte < jump->width; byte++) {
+            code[write++] = (offset >> (8 * byte)) & 0xFF;
+        }
+
+        read = jump->from + 5;
     }
 
-    compile_chunk->code[jump_index] = offset & 0xFF;
-    compile_chunk->code[jump_index + 1] = (offset >> 8) & 0xFF;
+    memmove(code + write, code + read, compiler->chunk->count - read);
+    compiler->chunk->count = write + compiler->chunk->count - read;
+
+    FREE_ARRAY(saved, int, compiler->jumps.count + 1, MEMORY_TEMPORARY);
 }
 
-static void statement();
+static void statement(Compiler *compiler);
 
-static void if_statement() {
-    consume(TOKEN_LEFT_PAREN, "expected '(' after 'if'.");
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "expected ')' after condition.");
+static void if_statement(Compiler *compiler) {
+    consume(compiler, TOKEN_LEFT_PAREN, "expected '(' after 'if'.");
+    expression(compiler);
+    consume(compiler, TOKEN_RIGHT_PAREN, "expected ')' after condition.");
 
-    int jump_then_index = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
+    int jump_then_index = emit_jump(compiler, OP_JUMP_IF_FALSE);
+    emit_byte(compiler, OP_POP);
 
-    if (!match(TOKEN_LEFT_BRACE)) {
-        error_at_current("expected '{' after condition.");
-        exit(1);
+    if (!match(compiler, TOKEN_LEFT_BRACE)) {
+        error_at_current(compiler, "expected '{' after condition.");
+        return;
     }
 
-    block();
+    block(compiler);
 
-    int jump_end_else_index = emit_jump(OP_JUMP);
+    int jump_end_else_index = emit_jump(compiler, OP_JUMP);
 
-    fix_jump_index(jump_then_index);
+    fix_jump_index(compiler, jump_then_index);
 
-    emit_byte(OP_POP);
+    emit_byte(compiler, OP_POP);
 
-    if (match(TOKEN_COLONS)) {
-        if (!match(TOKEN_LEFT_BRACE)) {
-            error_at_current("expected '{' after ':'.");
-            exit(1);
+    if (match(compiler, TOKEN_COLONS)) {
+        if (!match(compiler, TOKEN_LEFT_BRACE)) {
+            error_at_current(compiler, "expected '{' after ':'.");
+            return;
         }
-        block();
+        block(compiler);
+    }
+
+    fix_jump_index(compiler, jump_end_else_index);
+}
+
+static void emit_string(Compiler *compiler, const char *chars, int length);
+
+// the module runs with no locals of its own in scope, so imports only appear at top level
+static void import_statement(Compiler *compiler) {
+    if (compiler->locals.current_depth != 0) {
+        error_at_previous(compiler, "import is only allowed at top level.");
     }
 
-    fix_jump_index(jump_end_else_index);
+    consume(compiler, TOKEN_STRING, "expected module path after import.");
+    emit_byte(compiler, OP_IMPORT);
+    emit_string(compiler, compiler->parser.previous.start + 1, compiler->parser.previous.length - 2);
 }
 
-static void statement() {
-    if (match(TOKEN_PRINT)) {
-        print();
-        consume(TOKEN_SEMICOLON, "expected ';' after print statement.");
-    } else if (match(TOKEN_LEFT_BRACE)) {
-        block();
-    } else if (match(TOKEN_INTERROGATION)) {
-        if_statement();
+static void statement(Compiler *compiler) {
+    if (match(compiler, TOKEN_PRINT)) {
+        print(compiler);
+        consume(compiler, TOKEN_SEMICOLON, "expected ';' after print statement.");
+    } else if (match(compiler, TOKEN_LEFT_BRACE)) {
+        block(compiler);
+    } else if (match(compiler, TOKEN_INTERROGATION)) {
+        if_statement(compiler);
+    } else if (match(compiler, TOKEN_IMPORT)) {
+        import_statement(compiler);
+        consume(compiler, TOKEN_SEMICOLON, "expected ';' after import statement.");
     } else {
-        expression();
-        emit_byte(OP_POP);
-        consume(TOKEN_SEMICOLON, "expected ';' after expression.");
+        expression(compiler);
+        emit_byte(compiler, OP_POP);
+        consume(compiler, TOKEN_SEMICOLON, "expected ';' after expression.");
     }
 }
 
-static void emit_local(size_t idx) {
+static void emit_local(Compiler *compiler, size_t idx) {
     if (idx < 255) {
-        emit_bytes(2, OP_CONSTANT, idx);
+        emit_bytes(compiler, 2, OP_CONSTANT, idx);
     } else if (idx < 65535) {
-        emit_bytes(3, OP_CONSTANT_LONG, idx & 0xFF, (idx >> 8) & 0xFF);
+        emit_bytes(compiler, 3, OP_CONSTANT_LONG, idx & 0xFF, (idx >> 8) & 0xFF);
     } else if (idx < 16777215) {
-        emit_bytes(4, OP_CONSTANT_LONG_LONG, idx & 0xFF, (idx >> 8) & 0xFF, (idx >> 16) & 0xFF);
+        emit_bytes(compiler, 4, OP_CONSTANT_LONG_LONG, idx & 0xFF, (idx >> 8) & 0xFF, (idx >> 16) & 0xFF);
     } else {
-        error_at_previous("too many constants in one chunk.");
-        exit(1);
+        error_at_previous(compiler, "too many constants in one chunk.");
     }
 }
 
-static void var_definition() {
-    consume(TOKEN_IDENTIFIER, "expected identifier after variable definition.");
+static void var_definition(Compiler *compiler) {
+    consume(compiler, TOKEN_IDENTIFIER, "expected identifier after variable definition.");
 
-    Token prev = parser.previous;
+    Token prev = compiler->parser.previous;
 
-    if (match(TOKEN_EQUAL)) {
-        expression();
+    if (match(compiler, TOKEN_EQUAL)) {
+        expression(compiler);
     } else {
-        emit_byte(OP_NIL);
+        emit_byte(compiler, OP_NIL);
     }
 
-    if (locals.current_depth == 0) {
-        emit_byte(OP_DEFINE_GLOBAL);
-        emit_constant(NEW_OBJECT(make_objstring(prev.start, prev.length)));
+    ObjString *name = intern(compiler, prev.start, prev.length);
+
+    if (compiler->locals.current_depth == 0) {
+        emit_byte(compiler, OP_DEFINE_GLOBAL);
+        emit_constant(compiler, NEW_OBJECT(name));
     } else {
-        if (local_exists_in_cur_scope(prev)) {
-            compile_error(&prev, "variable with this name already defined in this scope.");
-            exit(1);
+        if (local_exists_in_cur_scope(compiler, name)) {
+            compile_error(compiler, &prev, "variable with this name already defined in this scope.");
+            return;
         }
-        emit_byte(OP_SET_LOCAL);
-        size_t local_idx = define_local(prev, locals.current_depth);
-        emit_local(local_idx);
+        emit_byte(compiler, OP_DEFINE_LOCAL);
+        size_t local_idx = define_local(compiler, name, compiler->locals.current_depth);
+        emit_local(compiler, local_idx);
     }
 
 }
 
-static void identifier(bool assignable) {
-    Value name = NEW_OBJECT(make_objstring(parser.previous.start, parser.previous.length));
-    Token prev = parser.previous;
+static void identifier(Compiler *compiler, bool assignable) {
+    Value name = NEW_OBJECT(intern(compiler, compiler->parser.previous.start, compiler->parser.previous.length));
 
-    if (match(TOKEN_EQUAL) && assignable) {
-        expression();
-        size_t local_idx = get_local_index(prev);
+    if (match(compiler, TOKEN_EQUAL) && assignable) {
+        expression(compiler);
+        size_t local_idx = get_local_index(compiler, AS_STRING(name));
         if (local_idx != -1) {
-            emit_byte(OP_SET_LOCAL);
-            emit_local(local_idx);
+            emit_byte(compiler, OP_SET_LOCAL);
+            emit_local(compiler, local_idx);
         } else {
-            emit_byte(OP_SET_GLOBAL);
-            emit_constant(name);
+            emit_byte(compiler, OP_SET_GLOBAL);
+            emit_constant(compiler, name);
         }
     } else {
-        size_t local_idx = get_local_index(prev);
+        size_t local_idx = get_local_index(compiler, AS_STRING(name));
         if (local_idx != -1) {
-            emit_byte(OP_GET_LOCAL);
-            emit_local(local_idx);
+            emit_byte(compiler, OP_GET_LOCAL);
+            emit_local(compiler, local_idx);
         } else {
-            emit_byte(OP_GET_GLOBAL);
-            emit_constant(name);
+            emit_byte(compiler, OP_GET_GLOBAL);
+            emit_constant(compiler, name);
         }
 
     }
 }
 
-static void definition() {
-    if (match(TOKEN_COLONS)) {
-        var_definition();
-        consume(TOKEN_SEMICOLON, "expected ';' after variable declaration.");
+static void definition(Compiler *compiler) {
+    if (match(compiler, TOKEN_COLONS)) {
+        var_definition(compiler);
+        consume(compiler, TOKEN_SEMICOLON, "expected ';' after variable declaration.");
     } else {
-        statement();
+        statement(compiler);
     }
 
-    if (parser.panic_mode) skip_to_next_statement();
+    // the code of the statement is complete, nothing is left half built if the compilation ends here
+    if (!within_budget(0)) {
+        error_at_previous(compiler, "memory limit exceeded.");
+        compiler->stopped = true;
+    }
+
+    if (compiler->parser.panic_mode && !compiler->stopped) skip_to_next_statement(compiler);
 }
 
-static void unary(bool assignable) {
-    TokenType operator_type = parser.previous.type;
-    parse_expression(PREC_UNARY);
+static void unary(Compiler *compiler, bool assignable) {
+    TokenType operator_type = compiler->parser.previous.type;
+    LinePosition operator = token_position(compiler, &compiler->parser.previous);
+    parse_expression(compiler, PREC_UNARY);
 
     switch (operator_type) {
         case TOKEN_NOT:
-            emit_byte(OP_NOT);
+            emit_byte_at(compiler, OP_NOT, operator);
             break;
         case TOKEN_MINUS:
-            emit_byte(OP_NEGATE);
+            emit_byte_at(compiler, OP_NEGATE, operator);
             break;
         case TOKEN_TILDE:
-            emit_byte(OP_BW_NOT);
+            emit_byte_at(compiler, OP_BW_NOT, operator);
         case TOKEN_PLUS:
             break;
         default:
@@ -437,98 +721,195 @@ static void unary(bool assignable) {
     }
 }
 
-static void binary(bool assignable) {
-    TokenType operator_type = parser.previous.type;
+static int concatenation_operand(Compiler *compiler, int count) {
+    // the operand count is a single byte, fold what has been pushed so far into one string first
+    if (count == UINT8_MAX) {
+        emit_bytes(compiler, 2, OP_CONCAT_N, count);
+        return 1;
+    }
+
+    return count;
+}
+
+/*
+ * Once one side of a '+' is known to be a string the result is a string too,
+ * so the rest of the '+' chain is gathered into a single OP_CONCAT_N.
+ */
+static void concatenation(Compiler *compiler, int count) {
+    while (match(compiler, TOKEN_PLUS)) {
+        count = concatenation_operand(compiler, count);
+        parse_expression(compiler, PREC_TERM + 1);
+        count++;
+    }
+
+    emit_bytes(compiler, 2, OP_CONCAT_N, count);
+    compiler->parser.string_end = compiler->chunk->count;
+}
+
+static void binary(Compiler *compiler, bool assignable) {
+    TokenType operator_type = compiler->parser.previous.type;
     ParseRule *rule = get_rule(operator_type);
-    parse_expression(rule->prec + 1);
+    bool left_is_string = compiler->parser.string_end == compiler->chunk->count;
+    // errors point at the operator rather than at the end of the right operand
+    LinePosition operator = token_position(compiler, &compiler->parser.previous);
+    parse_expression(compiler, rule->prec + 1);
+
+    if (operator_type == TOKEN_PLUS && (left_is_string || compiler->parser.string_end == compiler->chunk->count)) {
+        concatenation(compiler, 2);
+        return;
+    }
 
     switch (operator_type) {
         case TOKEN_PLUS:
-            emit_byte(OP_ADD);
+            emit_byte_at(compiler, OP_ADD, operator);
             break;
         case TOKEN_MINUS:
-            emit_byte(OP_SUBTRACT);
+            emit_byte_at(compiler, OP_SUBTRACT, operator);
             break;
         case TOKEN_STAR:
-            emit_byte(OP_MULTIPLY);
+            emit_byte_at(compiler, OP_MULTIPLY, operator);
             break;
         case TOKEN_SLASH:
-            emit_byte(OP_DIVIDE);
+            emit_byte_at(compiler, OP_DIVIDE, operator);
             break;
         case TOKEN_PERCENT:
-            emit_byte(OP_MODULO);
+            emit_byte_at(compiler, OP_MODULO, operator);
             break;
         case TOKEN_STAR_STAR:
-            emit_byte(OP_POW);
+            emit_byte_at(compiler, OP_POW, operator);
             break;
         case TOKEN_AND:
-            emit_byte(OP_AND);
+            emit_byte_at(compiler, OP_AND, operator);
             break;
         case TOKEN_OR:
-            emit_byte(OP_OR);
+            emit_byte_at(compiler, OP_OR, operator);
             break;
         case TOKEN_EQUAL_EQUAL:
-            emit_byte(OP_EQUALS);
+            emit_byte_at(compiler, OP_EQUALS, operator);
             break;
         case TOKEN_BANG_EQUAL:
-            emit_bytes(2, OP_EQUALS, OP_NOT);
+            emit_byte_at(compiler, OP_EQUALS, operator);
+            emit_byte_at(compiler, OP_NOT, operator);
             break;
         case TOKEN_GREATER:
-            emit_byte(OP_GREATER);
+            emit_byte_at(compiler, OP_GREATER, operator);
             break;
         case TOKEN_GREATER_EQUAL:
-            emit_bytes(2, OP_LESS, OP_NOT);
+            emit_byte_at(compiler, OP_LESS, operator);
+            emit_byte_at(compiler, OP_NOT, operator);
             break;
         case TOKEN_LESS:
-            emit_byte(OP_LESS);
+            emit_byte_at(compiler, OP_LESS, operator);
             break;
         case TOKEN_LESS_EQUAL:
-            emit_bytes(2, OP_GREATER, OP_NOT);
+            emit_byte_at(compiler, OP_GREATER, operator);
+            emit_byte_at(compiler, OP_NOT, operator);
             break;
         case TOKEN_AMPERSAND:
-            emit_byte(OP_BW_AND);
+            emit_byte_at(compiler, OP_BW_AND, operator);
             break;
         case TOKEN_PIPE:
-            emit_byte(OP_BW_OR);
+            emit_byte_at(compiler, OP_BW_OR, operator);
             break;
         case TOKEN_CARET:
-            emit_byte(OP_XOR);
+            emit_byte_at(compiler, OP_XOR, operator);
             break;
         case TOKEN_LESS_LESS:
-            emit_byte(OP_SHIFT_LEFT);
+            emit_byte_at(compiler, OP_SHIFT_LEFT, operator);
             break;
         case TOKEN_GREATER_GREATER:
-            emit_byte(OP_SHIFT_RIGHT);
+            emit_byte_at(compiler, OP_SHIFT_RIGHT, operator);
             break;
         default:
             return;
     }
 }
 
-static void ternary(bool assignable) {
-    parse_expression(PREC_TERNARY);
-    consume(TOKEN_COLONS, "expected ':' after '?' operator.");
-    parse_expression(PREC_TERNARY);
-    emit_byte(OP_TERNARY);
+static void ternary(Compiler *compiler, bool assignable) {
+    parse_expression(compiler, PREC_TERNARY);
+    consume(compiler, TOKEN_COLONS, "expected ':' after '?' operator.");
+    parse_expression(compiler, PREC_TERNARY);
+    emit_byte(compiler, OP_TERNARY);
 }
 
-static void grouping(bool assignable) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "expected ')' after expression.");
+static void grouping(Compiler *compiler, bool assignable) {
+    expression(compiler);
+    consume(compiler, TOKEN_RIGHT_PAREN, "expected ')' after expression.");
 }
 
-static void number(bool assignable) {
-    if (parser.previous.type == TOKEN_INTEGER) {
-        int64_t value = strtol(parser.previous.start, NULL, 10);
-        emit_constant(NEW_INTEGER(value));
-        return;
+#define MAX_EXACT_MANTISSA (1ull << 53)
+#define FAST_LITERAL_LENGTH 64
+
+static const double exact_powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// strtod/strtol on a NUL terminated copy of the literal, for the rare cases the fast paths can't take
+static void parse_number_slow(Token *token, int64_t *integer, double *decimal) {
+    char buffer[FAST_LITERAL_LENGTH];
+    char *chars = token->length < FAST_LITERAL_LENGTH ? buffer : ALLOCATE(char, token->length + 1, MEMORY_TEMPORARY);
+    memcpy(chars, token->start, token->length);
+    chars[token->length] = '\0';
+
+    if (integer != NULL) *integer = strtol(chars, NULL, 10);
+    if (decimal != NULL) *decimal = strtod(chars, NULL);
+
+    if (chars != buffer) FREE_ARRAY(chars, char, token->length + 1, MEMORY_TEMPORARY);
+}
+
+static int64_t parse_integer(Token *token) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < token->length; i++) {
+        uint64_t digit = token->start[i] - '0';
+        if (value > (INT64_MAX - digit) / 10) {
+            int64_t saturated;
+            parse_number_slow(token, &saturated, NULL);
+            return saturated;
+        }
+        value = value * 10 + digit;
+    }
+
+    return (int64_t) value;
+}
+
+/*
+ * A literal whose digits fit in 53 bits with at most 22 decimals is exactly mantissa / 10^decimals,
+ * and a single IEEE division of two exact values is correctly rounded.
+ */
+static double parse_decimal(Token *token) {
+    uint64_t mantissa = 0;
+    int decimals = -1;
+
+    for (int i = 0; i < token->length; i++) {
+        if (token->start[i] == '.') {
+            decimals = 0;
+            continue;
+        }
+
+        mantissa = mantissa * 10 + (token->start[i] - '0');
+        if (decimals >= 0) decimals++;
+
+        if (mantissa >= MAX_EXACT_MANTISSA || decimals > 22) {
+            double value;
+            parse_number_slow(token, NULL, &value);
+            return value;
+        }
+    }
+
+    return (double) mantissa / exact_powers_of_ten[decimals < 0 ? 0 : decimals];
+}
+
+static void number(Compiler *compiler, bool assignable) {
+    if (compiler->parser.previous.type == TOKEN_INTEGER) {
+        emit_constant(compiler, NEW_INTEGER(parse_integer(&compiler->parser.previous)));
     } else {
-        double value = strtod(parser.previous.start, NULL);
-        emit_constant(NEW_DECIMAL(value));
+        emit_constant(compiler, NEW_DECIMAL(parse_decimal(&compiler->parser.previous)));
     }
 }
 
-static void escape_string(char *chars, int *length) {
+static void escape_string(Compiler *compiler, char *chars, int *length) {
 #define ESCAPE_CHAR(r) chars[i] = r; memmove(chars + i + 1, chars + i + 2, *length - i - 1); (*length)--
 
     for (int i = 0; i < *length - 1; i++) {
@@ -564,9 +945,12 @@ static void escape_string(char *chars, int *length) {
                 case '\"':
                 ESCAPE_CHAR('\"');
                     break;
+                case '$':
+                ESCAPE_CHAR('$');
+                    break;
                 case 'x':
                     if (*length - i < 4) {
-                        error_at_previous("invalid escape sequence.");
+                        error_at_previous(compiler, "invalid escape sequence.");
                     }
 
                     char hex[3] = {chars[i + 2], chars[i + 3], '\0'};
@@ -575,7 +959,7 @@ static void escape_string(char *chars, int *length) {
                     long hex_value = strtol(hex, &end, 16);
 
                     if (*end != '\0') {
-                        error_at_previous("invalid escape sequence.");
+                        error_at_previous(compiler, "invalid escape sequence.");
                     }
 
                     chars[i] = (char) hex_value;
@@ -588,33 +972,126 @@ static void escape_string(char *chars, int *length) {
 #undef ESCAPE_CHAR
 }
 
-static void string(bool assignable) {
-    ObjString *string = make_objstring(parser.previous.start + 1, parser.previous.length - 2);
+static void emit_string(Compiler *compiler, const char *chars, int length) {
+    // escapes only shorten the string, the buffer is freed with the size it was allocated with
+    int size = length + 1;
+    char *escaped = ALLOCATE(char, size, MEMORY_TEMPORARY);
+    memcpy(escaped, chars, length);
+    escape_string(compiler, escaped, &length);
+
+    if (length <= SHORT_STRING_MAX) {
+        emit_constant(compiler, make_short_string(escaped, length));
+    } else {
+        emit_constant(compiler, NEW_OBJECT(intern(compiler, escaped, length)));
+    }
+    FREE_ARRAY(escaped, char, size, MEMORY_TEMPORARY);
+    compiler->parser.string_end = compiler->chunk->count;
+}
+
+static void string(Compiler *compiler, bool assignable) {
+    emit_string(compiler, compiler->parser.previous.start + 1, compiler->parser.previous.length - 2);
+}
+
+/*
+ * "a${x}b${y}c" arrives as the tokens '"a${' x '}b${' y '}c"': every piece of text
+ * and every expression becomes an operand of one OP_CONCAT_N.
+ */
+static void interpolation(Compiler *compiler, bool assignable) {
+    int count = 0;
+
+    do {
+        if (compiler->parser.previous.length > 3) {
+            count = concatenation_operand(compiler, count);
+            emit_string(compiler, compiler->parser.previous.start + 1, compiler->parser.previous.length - 3);
+            count++;
+        }
+
+        count = concatenation_operand(compiler, count);
+        expression(compiler);
+        count++;
+    } while (match(compiler, TOKEN_INTERPOLATION));
+
+    consume(compiler, TOKEN_STRING, "expected end of string after interpolation.");
+
+    if (compiler->parser.previous.type == TOKEN_STRING && compiler->parser.previous.length > 2) {
+        count = concatenation_operand(compiler, count);
+        emit_string(compiler, compiler->parser.previous.start + 1, compiler->parser.previous.length - 2);
+        count++;
+    }
+
+    emit_bytes(compiler, 2, OP_CONCAT_N, count);
+    compiler->parser.string_end = compiler->chunk->count;
+}
+
+// s[i] is a single character, s[start:end] the characters from start up to end, either of which can be left out
+static void subscript(Compiler *compiler, bool assignable) {
+    LinePosition bracket = token_position(compiler, &compiler->parser.previous);
+
+    if (match(compiler, TOKEN_COLONS)) {
+        emit_byte(compiler, OP_NIL);
+    } else {
+        expression(compiler);
+        if (match(compiler, TOKEN_RIGHT_BRACKET)) {
+            emit_byte_at(compiler, OP_INDEX, bracket);
+            compiler->parser.string_end = compiler->chunk->count;
+            return;
+        }
+        consume(compiler, TOKEN_COLONS, "expected ':' or ']' after index.");
+    }
+
+    if (compiler->parser.current.type == TOKEN_RIGHT_BRACKET) {
+        emit_byte(compiler, OP_NIL);
+    } else {
+        expression(compiler);
+    }
+    consume(compiler, TOKEN_RIGHT_BRACKET, "expected ']' after slice.");
+    emit_byte_at(compiler, OP_SLICE, bracket);
+    compiler->parser.string_end = compiler->chunk->count;
+}
+
+// text.name(arguments), the methods are known when compiling so a call names its method with a byte
+static void method(Compiler *compiler, bool assignable) {
+    LinePosition dot = token_position(compiler, &compiler->parser.previous);
+    consume(compiler, TOKEN_IDENTIFIER, "expected method name after '.'.");
+
+    int method = find_string_method(compiler->parser.previous.start, compiler->parser.previous.length);
+    if (method < 0) {
+        error_at_previous(compiler, "unknown method.");
+        return;
+    }
 
-    escape_string(string->chars, &string->length);
+    consume(compiler, TOKEN_LEFT_PAREN, "expected '(' after method name.");
+    for (int i = 0; i < string_methods[method].arity; i++) {
+        if (i > 0) consume(compiler, TOKEN_COMMA, "expected ',' between arguments.");
+        expression(compiler);
+    }
+    consume(compiler, TOKEN_RIGHT_PAREN, "expected ')' after arguments.");
 
-    emit_constant(NEW_OBJECT(string));
+    // errors are reported at the byte after the opcode
+    emit_byte_at(compiler, OP_METHOD, dot);
+    emit_byte_at(compiler, (uint8_t) method, dot);
+    if (method == METHOD_REPLACE) compiler->parser.string_end = compiler->chunk->count;
 }
 
-static void clock(bool assignable) {
-    emit_byte(OP_CLOCK);
+static void clock(Compiler *compiler, bool assignable) {
+    emit_byte(compiler, OP_CLOCK);
 }
 
-static void type_of(bool assignable) {
-    parse_expression(PREC_NONE + 1);
-    emit_byte(OP_TYPEOF);
+static void type_of(Compiler *compiler, bool assignable) {
+    parse_expression(compiler, PREC_NONE + 1);
+    emit_byte(compiler, OP_TYPEOF);
 }
 
-static void boolean(bool assignable) {
-    if (parser.previous.type == TOKEN_TRUE) {
-        emit_byte(OP_TRUE);
+static void boolean(Compiler *compiler, bool assignable) {
+    if (compiler->parser.previous.type == TOKEN_TRUE) {
+        emit_byte(compiler, OP_TRUE);
     } else {
-        emit_byte(OP_FALSE);
+        emit_byte(compiler, OP_FALSE);
     }
 }
 
-static void nil(bool assignable) {
-    emit_byte(OP_NIL);
+static void nil(Compiler *compiler, bool assignable) {
+    emit_byte(compiler, OP_NIL);
 }
 
 ParseRule parse_rules[] = {
@@ -622,8 +1099,10 @@ ParseRule parse_rules[] = {
         [TOKEN_RIGHT_PAREN] =   {NULL, NULL, PREC_NONE},
         [TOKEN_LEFT_BRACE]  =   {NULL, NULL, PREC_NONE},
         [TOKEN_RIGHT_BRACE] =   {NULL, NULL, PREC_NONE},
+        [TOKEN_LEFT_BRACKET] =  {NULL, subscript, PREC_CALL},
+        [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
         [TOKEN_COMMA]       =   {NULL, NULL, PREC_NONE},
-        [TOKEN_DOT]         =   {NULL, NULL, PREC_CALL},
+        [TOKEN_DOT]         =   {NULL, method, PREC_CALL},
         [TOKEN_MINUS]       =   {unary, binary, PREC_TERM},
         [TOKEN_PLUS]        =   {unary, binary, PREC_TERM},
         [TOKEN_SEMICOLON]   =   {NULL, NULL, PREC_NONE},
@@ -652,9 +1131,11 @@ ParseRule parse_rules[] = {
         [TOKEN_LESS_EQUAL]  =   {NULL, binary, PREC_COMPARE},
         [TOKEN_IDENTIFIER]  =   {identifier, NULL, PREC_NONE},
         [TOKEN_STRING]      =   {string, NULL, PREC_NONE},
+        [TOKEN_INTERPOLATION] = {interpolation, NULL, PREC_NONE},
         [TOKEN_INTEGER]      =   {number, NULL, PREC_NONE},
         [TOKEN_FLOAT]      =   {number, NULL, PREC_NONE},
         [TOKEN_RETURN]      =   {NULL, NULL, PREC_NONE},
+        [TOKEN_IMPORT]      =   {NULL, NULL, PREC_NONE},
         [TOKEN_IF]          =   {NULL, NULL, PREC_NONE},
         [TOKEN_ELSE]        =   {NULL, NULL, PREC_NONE},
         [TOKEN_EOF]         =   {NULL, NULL, PREC_NONE},
@@ -672,16 +1153,117 @@ static ParseRule *get_rule(TokenType type) {
 }
 
 
-bool compile(Chunk *chunk, const char *source) {
-    init_scanner(source);
-    init_compiler(chunk);
+static bool compile_program(Compiler *compiler) {
+    CompileStats *stats = compiler->stats;
+    double start = stats != NULL ? now_seconds() : 0;
+
+    advance(compiler);
+    while (!compiler->stopped && !match(compiler, TOKEN_EOF)) {
+        definition(compiler);
+    }
+
+    emit_byte(compiler, OP_RETURN);
+
+    if (stats != NULL) {
+        stats->parse_time = now_seconds() - start - stats->intern_time;
+        start = now_seconds();
+    }
+
+    if (!compiler->parser.has_error) {
+        relax_jumps(compiler);
+    }
+
+    if (stats != NULL) {
+        stats->relax_time = now_seconds() - start;
+    }
+
+    free_compiler(compiler);
+
+    return !compiler->parser.has_error;
+}
+
+bool compile_with_stats(Chunk *chunk, const char *source, size_t length, Hashmap *strings, CompileStats *stats) {
+    Compiler compiler;
+    init_compiler(&compiler, chunk, source, length, strings, stats);
+    return compile_program(&compiler);
+}
+
+bool compile(Chunk *chunk, const char *source, size_t length, Hashmap *strings) {
+    return compile_with_stats(chunk, source, length, strings, NULL);
+}
+
+// hands the statements compiled so far to run and starts the next segment in an empty chunk
+static bool end_segment(Compiler *compiler) {
+    emit_byte(compiler, OP_RETURN);
+    relax_jumps(compiler);
+
+    if (!compiler->run(compiler->chunk, compiler->parser.current.start)) {
+        compiler->stopped = true;
+    }
+
+    free_chunk(compiler->chunk);
+    compiler->jumps.count = 0;
+    compiler->parser.string_end = -1;
+    return !compiler->stopped;
+}
+
+static bool compile_in_segments(Compiler *compiler) {
+    advance(compiler);
+    while (!compiler->stopped && !match(compiler, TOKEN_EOF)) {
+        definition(compiler);
+
+        // top-level statements leave no locals and no pending jumps behind, so the chunk can be cut here
+        if (compiler->chunk->count >= SEGMENT_BYTES) {
+            if (compiler->parser.has_error) {
+                free_chunk(compiler->chunk);
+                compiler->jumps.count = 0;
+            } else {
+                end_segment(compiler);
+            }
+        }
+    }
+
+    if (!compiler->parser.has_error && !compiler->stopped) {
+        end_segment(compiler);
+    }
+
+    free_compiler(compiler);
+    return !compiler->parser.has_error;
+}
+
+bool compile_segments(Chunk *chunk, const char *source, size_t length, Hashmap *strings, segment_fn run) {
+    Compiler compiler;
+    init_compiler(&compiler, chunk, source, length, strings, NULL);
+    compiler.run = run;
+    return compile_in_segments(&compiler);
+}
+
+bool compile_stream(Chunk *chunk, SourceStream *input, Hashmap *strings, segment_fn run) {
+    Compiler compiler;
+    init_compiler(&compiler, chunk, input->chars, input->length, strings, NULL);
+    compiler.input = input;
+    compiler.run = run;
+    return compile_in_segments(&compiler);
+}
+
+bool compile_parallel(Chunk *chunk, const char *source, size_t length, Hashmap *strings, CompileStats *stats) {
+    double start = stats != NULL ? now_seconds() : 0;
 
-    advance();
-    while (!match(TOKEN_EOF)) {
-        definition();
+    TokenStream tokens;
+    if (!tokenize_parallel(&tokens, source, length)) {
+        return compile_with_stats(chunk, source, length, strings, stats);
     }
 
-    emit_byte(OP_RETURN);
+    if (stats != NULL) {
+        stats->scan_time = now_seconds() - start;
+        stats->tokens = token_count(&tokens);
+    }
+
+    Compiler compiler;
+    init_compiler(&compiler, chunk, source, length, strings, stats);
+    compiler.tokens = &tokens;
+    bool compiled = compile_program(&compiler);
 
-    return !parser.has_error;
-}
\ No newline at end of file
+    free_token_stream(&tokens);
+    return compiled;
+}
@@ -1,8 +1,34 @@
 #include "chunk.h"
+#include "hashmap.h"
+#include "stats.h"
+#include "source_file.h"
 
 #ifndef FILANG_COMPILER_H
 #define FILANG_COMPILER_H
 
-bool compile(Chunk *chunk, const char *source);
+// runs a compiled segment, resume is where the source still to be compiled starts
+typedef bool (*segment_fn)(Chunk *chunk, const char *resume);
+
+bool compile(Chunk *chunk, const char *source, size_t length, Hashmap *strings);
+
+bool compile_with_stats(Chunk *chunk, const char *source, size_t length, Hashmap *strings, CompileStats *stats);
+
+/*
+ * Same as compile_with_stats(), but the source is first tokenized in pieces on several threads.
+ */
+bool compile_parallel(Chunk *chunk, const char *source, size_t length, Hashmap *strings, CompileStats *stats);
+
+/*
+ * Compiles source a few top-level statements at a time: each time chunk holds 64KB of code
+ * it is handed to run and emptied, so memory does not grow with the length of the script.
+ * Compilation stops when run returns false. Returns false if the source has errors.
+ */
+bool compile_segments(Chunk *chunk, const char *source, size_t length, Hashmap *strings, segment_fn run);
+
+/*
+ * Same as compile_segments(), for a source that is still being read: whenever the next token
+ * has not fully arrived, the top-level statements compiled so far are handed to run first.
+ */
+bool compile_stream(Chunk *chunk, SourceStream *input, Hashmap *strings, segment_fn run);
 
 #endif //FILANG_COMPILER_H
@@ -1,133 +1,94 @@
 #include <stdio.h>
 #include "disassembler.h"
 
+static const char *opcode_names[] = {
+        [OP_ERROR]               = "OP_ERROR",
+        [OP_RETURN]              = "OP_RETURN",
+        [OP_ADD]                 = "OP_ADD",
+        [OP_CONCAT_N]            = "OP_CONCAT_N",
+        [OP_SUBTRACT]            = "OP_SUBTRACT",
+        [OP_MULTIPLY]            = "OP_MULTIPLY",
+        [OP_DIVIDE]              = "OP_DIVIDE",
+        [OP_MODULO]              = "OP_MODULO",
+        [OP_NEGATE]              = "OP_NEGATE",
+        [OP_POW]                 = "OP_POW",
+        [OP_NOT]                 = "OP_NOT",
+        [OP_AND]                 = "OP_AND",
+        [OP_OR]                  = "OP_OR",
+        [OP_BW_AND]              = "OP_BW_AND",
+        [OP_BW_OR]               = "OP_BW_OR",
+        [OP_XOR]                 = "OP_XOR",
+        [OP_BW_NOT]              = "OP_BW_NOT",
+        [OP_SHIFT_LEFT]          = "OP_SHIFT_LEFT",
+        [OP_SHIFT_RIGHT]         = "OP_SHIFT_RIGHT",
+        [OP_TERNARY]             = "OP_TERNARY",
+        [OP_PRINT]               = "OP_PRINT",
+        [OP_GREATER]             = "OP_GREATER",
+        [OP_LESS]                = "OP_LESS",
+        [OP_EQUALS]              = "OP_EQUALS",
+        [OP_NIL]                 = "OP_NIL",
+        [OP_TRUE]                = "OP_TRUE",
+        [OP_FALSE]               = "OP_FALSE",
+        [OP_CONSTANT]            = "OP_CONSTANT",
+        [OP_CONSTANT_LONG]       = "OP_CONSTANT_LONG",
+        [OP_CONSTANT_LONG_LONG]  = "OP_CONSTANT_LONG_LONG",
+        [OP_POP]                 = "OP_POP",
+        [OP_DEFINE_GLOBAL]       = "OP_DEFINE_GLOBAL",
+        [OP_GET_GLOBAL]          = "OP_GET_GLOBAL",
+        [OP_SET_GLOBAL]          = "OP_SET_GLOBAL",
+        [OP_GET_LOCAL]           = "OP_GET_LOCAL",
+        [OP_SET_LOCAL]           = "OP_SET_LOCAL",
+        [OP_DEFINE_LOCAL]        = "OP_DEFINE_LOCAL",
+        [OP_CLOCK]               = "OP_CLOCK",
+        [OP_TYPEOF]              = "OP_TYPEOF",
+        [OP_IMPORT]              = "OP_IMPORT",
+        [OP_INDEX]               = "OP_INDEX",
+        [OP_SLICE]               = "OP_SLICE",
+        [OP_METHOD]              = "OP_METHOD",
+        [OP_JUMP_SHORT]          = "OP_JUMP_SHORT",
+        [OP_JUMP]                = "OP_JUMP",
+        [OP_JUMP_WIDE]           = "OP_JUMP_WIDE",
+        [OP_JUMP_IF_FALSE_SHORT] = "OP_JUMP_IF_FALSE_SHORT",
+        [OP_JUMP_IF_FALSE]       = "OP_JUMP_IF_FALSE",
+        [OP_JUMP_IF_FALSE_WIDE]  = "OP_JUMP_IF_FALSE_WIDE",
+};
+
+// bytes following the opcode, every opcode not listed here has none
+static const int operand_bytes[sizeof(opcode_names) / sizeof(opcode_names[0])] = {
+        [OP_CONCAT_N]            = 1,
+        [OP_CONSTANT]            = 1,
+        [OP_METHOD]              = 1,
+        [OP_CONSTANT_LONG]       = 2,
+        [OP_CONSTANT_LONG_LONG]  = 3,
+        [OP_JUMP_SHORT]          = 1,
+        [OP_JUMP]                = 2,
+        [OP_JUMP_WIDE]           = 4,
+        [OP_JUMP_IF_FALSE_SHORT] = 1,
+        [OP_JUMP_IF_FALSE]       = 2,
+        [OP_JUMP_IF_FALSE_WIDE]  = 4,
+};
+
+const char *opcode_name(uint8_t opcode) {
+    if (opcode >= sizeof(opcode_names) / sizeof(opcode_names[0]) || opcode_names[opcode] == NULL) {
+        return NULL;
+    }
+
+    return opcode_names[opcode];
+}
+
+int instruction_length(uint8_t opcode) {
+    if (opcode >= sizeof(operand_bytes) / sizeof(operand_bytes[0])) return 1;
+    return 1 + operand_bytes[opcode];
+}
+
 void disassemble(Chunk *chunk) {
-    for (int i = 0; i < chunk->count; i++) {
-        switch (chunk->code[i]) {
-            case OP_RETURN:
-                printf("OP_RETURN\n");
-                break;
-            case OP_CONSTANT:
-                printf("OP_CONSTANT\n");
-                i++;
-                break;
-            case OP_CONSTANT_LONG:
-                printf("OP_CONSTANT_LONG\n");
-                i += 2;
-                break;
-            case OP_CONSTANT_LONG_LONG:
-                printf("OP_CONSTANT_LONG_LONG\n");
-                i += 3;
-                break;
-            case OP_NEGATE:
-                printf("OP_NEGATE\n");
-                break;
-            case OP_ADD:
-                printf("OP_ADD\n");
-                break;
-            case OP_SUBTRACT:
-                printf("OP_SUBTRACT\n");
-                break;
-            case OP_MULTIPLY:
-                printf("OP_MULTIPLY\n");
-                break;
-            case OP_DIVIDE:
-                printf("OP_DIVIDE\n");
-                break;
-            case OP_NIL:
-                printf("OP_NIL\n");
-                break;
-            case OP_TRUE:
-                printf("OP_TRUE\n");
-                break;
-            case OP_FALSE:
-                printf("OP_FALSE\n");
-                break;
-            case OP_NOT:
-                printf("OP_NOT\n");
-                break;
-            case OP_EQUALS:
-                printf("OP_EQUAL\n");
-                break;
-            case OP_GREATER:
-                printf("OP_GREATER\n");
-                break;
-            case OP_LESS:
-                printf("OP_LESS\n");
-                break;
-            case OP_PRINT:
-                printf("OP_PRINT\n");
-                break;
-            case OP_POP:
-                printf("OP_POP\n");
-                break;
-            case OP_DEFINE_GLOBAL:
-                printf("OP_DEFINE_GLOBAL\n");
-                break;
-            case OP_GET_GLOBAL:
-                printf("OP_GET_GLOBAL\n");
-                break;
-            case OP_SET_GLOBAL:
-                printf("OP_SET_GLOBAL\n");
-                break;
-            case OP_GET_LOCAL:
-                printf("OP_GET_LOCAL\n");
-                break;
-            case OP_SET_LOCAL:
-                printf("OP_SET_LOCAL\n");
-                break;
-            case OP_CLOCK:
-                printf("OP_CLOCK\n");
-                break;
-            case OP_TYPEOF:
-                printf("OP_TYPEOF\n");
-                break;
-            case OP_MODULO:
-                printf("OP_MODULO\n");
-                break;
-            case OP_POW:
-                printf("OP_POW\n");
-                break;
-            case OP_AND:
-                printf("OP_AND\n");
-                break;
-            case OP_OR:
-                printf("OP_OR\n");
-                break;
-            case OP_BW_AND:
-                printf("OP_BW_AND\n");
-                break;
-            case OP_BW_OR:
-                printf("OP_BW_OR\n");
-                break;
-            case OP_XOR:
-                printf("OP_XOR\n");
-                break;
-            case OP_BW_NOT:
-                printf("OP_BW_NOT\n");
-                break;
-            case OP_SHIFT_LEFT:
-                printf("OP_SHIFT_LEFT\n");
-                break;
-            case OP_SHIFT_RIGHT:
-                printf("OP_SHIFT_RIGHT\n");
-                break;
-            case OP_TERNARY:
-                printf("OP_TERNARY\n");
-                break;
-            case OP_ERROR:
-                printf("OP_ERROR\n");
-                break;
-            case OP_JUMP:
-                printf("OP_JUMP\n");
-                i += 2;
-                break;
-            case OP_JUMP_IF_FALSE:
-                printf("OP_JUMP_IF_FALSE\n");
-                i += 2;
-                break;
-            default:
-                printf("Unknown opcode %d\n", chunk->code[i]);
+    for (int i = 0; i < chunk->count; i += instruction_length(chunk->code[i])) {
+        const char *name = opcode_name(chunk->code[i]);
+
+        if (name != NULL) {
+            printf("%s\n", name);
+        } else {
+            printf("Unknown opcode %d\n", chunk->code[i]);
         }
     }
-}
\ No newline at end of file
+}
@@ -3,6 +3,10 @@
 
 #include "chunk.h"
 
+const char *opcode_name(uint8_t opcode);
+
+int instruction_length(uint8_t opcode);
+
 void disassemble(Chunk *chunk);
 
 #endif //FILANG_DISASSEMBLER_H
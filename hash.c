@@ -0,0 +1,214 @@
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash.h"
+
+/*
+ * Strings up to LONG_HASH_MIN bytes are hashed as wyhash does, 8 bytes at a time folded through 64x64->128 bit
+ * multiplies. Longer ones go through 8 lanes of 64 bit accumulators, 64 bytes a step, as XXH3 does, which only
+ * needs 32x32->64 bit multiplies and so is vectorised with the same result as the portable loop.
+ * Everything is keyed by a seed drawn for each process, so that colliding keys cannot be precomputed.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define LONG_HASH_MIN 1024
+#define STRIPE 64
+#define STRIPE_LANES 8
+#define STRIPES_PER_BLOCK 16
+// stripe i of a block is keyed from stripe_keys[i], the last stripe of the string from stripe_keys[STRIPES_PER_BLOCK]
+#define STRIPE_KEYS (STRIPES_PER_BLOCK + STRIPE_LANES)
+#define SCRAMBLE_PRIME 0x9E3779B1u
+
+static const uint64_t secrets[4] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull,
+                                    0x589965cc75374cc3ull};
+
+uint64_t hash_seed;
+static uint64_t stripe_keys[STRIPE_KEYS];
+static uint64_t scramble_keys[STRIPE_LANES];
+
+static uint64_t splitmix(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void set_hash_seed(uint64_t seed) {
+    hash_seed = seed;
+    uint64_t state = seed;
+    for (int i = 0; i < STRIPE_KEYS; i++) stripe_keys[i] = splitmix(&state);
+    for (int i = 0; i < STRIPE_LANES; i++) scramble_keys[i] = splitmix(&state);
+}
+
+void init_hash_seed() {
+    uint64_t seed;
+    if (getentropy(&seed, sizeof(seed)) != 0) {
+        seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32) ^ (uintptr_t) &seed;
+    }
+    set_hash_seed(seed);
+}
+
+// the 128 bit product of a and b, its two halves xored together
+static uint64_t mix(uint64_t a, uint64_t b) {
+    unsigned __int128 product = (unsigned __int128) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static uint64_t read64(const char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t read32(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// stripes in a row from p, the first keyed from keys and each following one from the next word on
+static void accumulate(uint64_t *accumulators, const char *p, size_t stripes, const uint64_t *keys) {
+#if defined(__AVX2__)
+#define ACCUMULATE(lane, offset) do {                                                                     \
+        __m256i data = _mm256_loadu_si256((const __m256i *) (p + stripe * STRIPE + (offset) * 8));          \
+        __m256i keyed = _mm256_xor_si256(data, _mm256_loadu_si256((const __m256i *) (keys + stripe + (offset)))); \
+        __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));                           \
+        lane = _mm256_add_epi64(lane, _mm256_add_epi64(product, _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)))); \
+    } while (false)
+
+    __m256i low = _mm256_loadu_si256((const __m256i *) accumulators);
+    __m256i high = _mm256_loadu_si256((const __m256i *) (accumulators + 4));
+    for (size_t stripe = 0; stripe < stripes; stripe++) {
+        ACCUMULATE(low, 0);
+        ACCUMULATE(high, 4);
+    }
+    _mm256_storeu_si256((__m256i *) accumulators, low);
+    _mm256_storeu_si256((__m256i *) (accumulators + 4), high);
+#elif defined(__SSE2__)
+#define ACCUMULATE(lane, offset) do {                                                                     \
+        __m128i data = _mm_loadu_si128((const __m128i *) (p + stripe * STRIPE + (offset) * 8));             \
+        __m128i keyed = _mm_xor_si128(data, _mm_loadu_si128((const __m128i *) (keys + stripe + (offset))));    \
+        __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));                                  \
+        lane = _mm_add_epi64(lane, _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)))); \
+    } while (false)
+
+    __m128i first = _mm_loadu_si128((const __m128i *) accumulators);
+    __m128i second = _mm_loadu_si128((const __m128i *) (accumulators + 2));
+    __m128i third = _mm_loadu_si128((const __m128i *) (accumulators + 4));
+    __m128i fourth = _mm_loadu_si128((const __m128i *) (accumulators + 6));
+    for (size_t stripe = 0; stripe < stripes; stripe++) {
+        ACCUMULATE(first, 0);
+        ACCUMULATE(second, 2);
+        ACCUMULATE(third, 4);
+        ACCUMULATE(fourth, 6);
+    }
+    _mm_storeu_si128((__m128i *) accumulators, first);
+    _mm_storeu_si128((__m128i *) (accumulators + 2), second);
+    _mm_storeu_si128((__m128i *) (accumulators + 4), third);
+    _mm_storeu_si128((__m128i *) (accumulators + 6), fourth);
+#else
+    // each lane adds the product of the halves of its keyed word and the word next to it as it is
+    for (size_t stripe = 0; stripe < stripes; stripe++) {
+        for (int i = 0; i < STRIPE_LANES; i++) {
+            uint64_t keyed = read64(p + stripe * STRIPE + i * 8) ^ keys[stripe + i];
+            accumulators[i] += (keyed & 0xFFFFFFFFu) * (keyed >> 32) + read64(p + stripe * STRIPE + (i ^ 1) * 8);
+        }
+    }
+#endif
+}
+
+static void scramble(uint64_t *accumulators) {
+    for (int i = 0; i < STRIPE_LANES; i++) {
+        uint64_t accumulator = accumulators[i] ^ (accumulators[i] >> 47) ^ scramble_keys[i];
+        accumulators[i] = accumulator * SCRAMBLE_PRIME;
+    }
+}
+
+static uint64_t hash_long(const char *p, size_t length) {
+    uint64_t accumulators[STRIPE_LANES];
+    for (int i = 0; i < STRIPE_LANES; i++) accumulators[i] = secrets[i & 3] ^ hash_seed;
+
+    // the last stripe is always the last STRIPE bytes, whether or not they overlap the one before
+    size_t stripes = (length - 1) / STRIPE;
+    for (size_t block = 0; block < stripes / STRIPES_PER_BLOCK; block++) {
+        accumulate(accumulators, p + block * STRIPE * STRIPES_PER_BLOCK, STRIPES_PER_BLOCK, stripe_keys);
+        scramble(accumulators);
+    }
+    accumulate(accumulators, p + (stripes - stripes % STRIPES_PER_BLOCK) * STRIPE, stripes % STRIPES_PER_BLOCK,
+               stripe_keys);
+    accumulate(accumulators, p + length - STRIPE, 1, stripe_keys + STRIPES_PER_BLOCK);
+
+    uint64_t hash = length * 0x9E3779B185EBCA87ull;
+    for (int i = 0; i < STRIPE_LANES; i += 2) {
+        hash += mix(accumulators[i] ^ scramble_keys[i], accumulators[i + 1] ^ scramble_keys[i + 1]);
+    }
+    return mix(hash ^ secrets[0], hash_seed ^ secrets[1]);
+}
+
+static uint64_t hash_bytes(const char *p, size_t length) {
+    if (length >= LONG_HASH_MIN) return hash_long(p, length);
+
+    uint64_t seed = hash_seed ^ mix(hash_seed ^ secrets[0], secrets[1]);
+    uint64_t a, b;
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t middle = (length >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + middle);
+            b = (read32(p + length - 4) << 32) | read32(p + length - 4 - middle);
+        } else if (length > 0) {
+            a = ((uint64_t) (uint8_t) p[0] << 16) | ((uint64_t) (uint8_t) p[length >> 1] << 8) |
+                (uint8_t) p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t left = length;
+        // three independent lanes keep the multipliers busy
+        if (left > 48) {
+            uint64_t second = seed, third = seed;
+            do {
+                seed = mix(read64(p) ^ secrets[1], read64(p + 8) ^ seed);
+                second = mix(read64(p + 16) ^ secrets[2], read64(p + 24) ^ second);
+                third = mix(read64(p + 32) ^ secrets[3], read64(p + 40) ^ third);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= second ^ third;
+        }
+        while (left > 16) {
+            seed = mix(read64(p) ^ secrets[1], read64(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+        a = read64(p + left - 16);
+        b = read64(p + left - 8);
+    }
+
+    unsigned __int128 product = (unsigned __int128) (a ^ secrets[1]) * (b ^ seed);
+    return mix((uint64_t) product ^ secrets[0] ^ length, (uint64_t) (product >> 64) ^ secrets[1]);
+}
+
+uint32_t hash_string(const char *key, int length) {
+    return (uint32_t) hash_bytes(key, (size_t) length);
+}
+
+uint32_t hash_word(uint64_t key) {
+    return (uint32_t) mix(key ^ hash_seed ^ secrets[0], mix(key ^ secrets[1], hash_seed ^ secrets[2]));
+}
+
+uint32_t hash_double(double key) {
+    if (key == 0) key = 0;
+    uint64_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return hash_word(bits);
+}
+
+uint32_t hash_int(int64_t key) {
+    return hash_word((uint64_t) key);
+}
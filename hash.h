@@ -0,0 +1,22 @@
+#ifndef FILANG_HASH_H
+#define FILANG_HASH_H
+
+#include <stdint.h>
+
+// drawn for each process, only a snapshot restored before anything was hashed brings back its own
+extern uint64_t hash_seed;
+
+void init_hash_seed();
+
+void set_hash_seed(uint64_t seed);
+
+uint32_t hash_string(const char *key, int length);
+
+uint32_t hash_word(uint64_t key);
+
+// equal numbers hash the same, 0.0 and -0.0 included
+uint32_t hash_double(double key);
+
+uint32_t hash_int(int64_t key);
+
+#endif //FILANG_HASH_H
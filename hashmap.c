@@ -4,40 +4,6 @@
 #include "value.h"
 #include "strings.h"
 
-
-uint32_t hash_string(const char *key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= key[i];
-        hash *= 16777619;
-    }
-    return hash;
-}
-
-uint32_t hash_double(double key) {
-    const uint32_t fnv_offset = 2166136261u;
-    const uint32_t fnv_prime = 16777619u;
-    uint32_t hash = fnv_offset;
-    uint8_t *bytes = (uint8_t *) &key;
-    for (size_t i = 0; i < sizeof(double); i++) {
-        hash ^= bytes[i];
-        hash *= fnv_prime;
-    }
-    return hash;
-}
-
-uint32_t hash_int(int64_t key) {
-    const uint32_t fnv_offset = 2166136261u;
-    const uint32_t fnv_prime = 16777619u;
-    uint32_t hash = fnv_offset;
-    uint8_t *bytes = (uint8_t *) &key;
-    for (size_t i = 0; i < sizeof(key); i++) {
-        hash ^= bytes[i];
-        hash *= fnv_prime;
-    }
-    return hash;
-}
-
 static bool compare(Value a, Value b) {
     if (a.type != b.type) return false;
     switch (a.type) {
@@ -46,11 +12,11 @@ static bool compare(Value a, Value b) {
             return a.as.integer == b.as.integer;
         case TYPE_DECIMAL:
             return a.as.decimal == b.as.decimal;
+        case TYPE_SHORT_STRING:
+            return a.as.integer == b.as.integer;
         case TYPE_OBJECT:
-            if (IS_STRING(a) && IS_STRING(b)) {
-                return AS_STRING(a) == AS_STRING(b);
-            }
-            return false;
+            if (a.as.object == b.as.object) return true;
+            return IS_TEXT(a) && IS_TEXT(b) && texts_equal(a, b);
         default:
             return false;
     }
@@ -63,11 +29,13 @@ uint32_t get_hash(Value val) {
             return hash_int(val.as.integer);
         case TYPE_DECIMAL:
             return hash_double(val.as.decimal);
+        case TYPE_SHORT_STRING:
+            return hash_string(val.as.chars, SHORT_STRING_LENGTH(val));
         case TYPE_OBJECT:
-            if (IS_STRING(val)) {
-                return AS_STRING(val)->hash;
+            if (IS_TEXT(val)) {
+                return string_hash(text_string_unchecked(val));
             }
-            return (uint32_t) (intptr_t) val.as.object;
+            return hash_word((uintptr_t) val.as.object);
         default:
             return 0;
     }
@@ -80,7 +48,7 @@ void init_hashmap(Hashmap *map) {
 }
 
 void free_hashmap(Hashmap *map) {
-    FREE_ARRAY(map->entries, Entry, map->capacity);
+    FREE_ARRAY(map->entries, Entry, map->capacity, MEMORY_ENTRIES);
     init_hashmap(map);
 }
 
@@ -88,7 +56,7 @@ void grow_capacity(Hashmap *map) {
     uint32_t old_capacity = map->capacity;
     Entry *old_entries = map->entries;
     map->capacity = GROW_ARRAY_CAPACITY(old_capacity);
-    map->entries = ALLOCATE(Entry, map->capacity);
+    map->entries = ALLOCATE(Entry, map->capacity, MEMORY_ENTRIES);
     for (int i = 0; i < map->capacity; i++) {
         map->entries[i].key.type = TYPE_NIL;
         map->entries[i].value = NIL;
@@ -100,7 +68,7 @@ void grow_capacity(Hashmap *map) {
         if (entry->key.type == TYPE_NIL) continue;
         add_entry(map, entry->key, entry->value);
     }
-    FREE_ARRAY(old_entries, Entry, old_capacity);
+    FREE_ARRAY(old_entries, Entry, old_capacity, MEMORY_ENTRIES);
 }
 
 static void remove_by_index(Hashmap *map, uint32_t index) {
@@ -156,10 +124,10 @@ bool add_entry(Hashmap *map, Value key, Value value) {
 
     uint32_t index = get_hash(key) & (map->capacity - 1);
     uint32_t dist = 0;
-    map->count++;
 
     for (;;) {
         if (IS_EMPTY(map->entries[index])) {
+            map->count++;
             map->entries[index].key = key;
             map->entries[index].value = value;
             return false;
@@ -6,6 +6,7 @@
 #include "value.h"
 #include "value.h"
 #include "strings.h"
+#include "hash.h"
 
 /*
  * Robin Hood Hashmap implementation
@@ -16,14 +17,12 @@ typedef struct {
     Value value;
 } Entry;
 
-typedef struct {
+typedef struct Hashmap {
     int count;
     int capacity;
     Entry *entries;
 } Hashmap;
 
-uint32_t hash_string(const char *key, int length);
-
 void init_hashmap(Hashmap *map);
 
 void free_hashmap(Hashmap *map);
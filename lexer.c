@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "lexer.h"
+#include "scanner.h"
+#include "memory.h"
+
+#define MAX_WORKERS 64
+#define PIECES_PER_WORKER 4
+#define MIN_PIECE_BYTES (1 << 16)
+
+typedef struct {
+    TokenStream *stream;
+    atomic_int next;
+} LexJob;
+
+static void push_token(TokenPiece *piece, Token token) {
+    if (piece->count + 1 >= piece->capacity) {
+        int old_capacity = piece->capacity;
+        piece->capacity = GROW_ARRAY_CAPACITY(old_capacity);
+        piece->tokens = GROW_ARRAY(piece->tokens, PackedToken, old_capacity, piece->capacity, MEMORY_TEMPORARY);
+    }
+
+    PackedToken *packed = &piece->tokens[piece->count++];
+    packed->type = (uint8_t) token.type;
+    packed->length = (uint32_t) token.length;
+    packed->line = (uint32_t) token.line;
+
+    if (token.type == TOKEN_ERROR) {
+        if (piece->error_count + 1 >= piece->error_capacity) {
+            int old_capacity = piece->error_capacity;
+            piece->error_capacity = GROW_ARRAY_CAPACITY(old_capacity);
+            piece->errors = GROW_ARRAY(piece->errors, char *, old_capacity, piece->error_capacity, MEMORY_TEMPORARY);
+        }
+
+        packed->offset = (uint32_t) piece->error_count;
+        piece->errors[piece->error_count++] = (char *) token.start;
+    } else {
+        packed->offset = (uint32_t) (token.start - piece->start);
+    }
+}
+
+static void tokenize_piece(TokenPiece *piece, bool last) {
+    Scanner scanner;
+    init_scanner(&scanner, piece->start, piece->end - piece->start);
+
+    for (;;) {
+        Token token = scan_token(&scanner);
+
+        // only the last piece ends the file
+        if (token.type == TOKEN_EOF && !last) break;
+
+        push_token(piece, token);
+        if (token.type == TOKEN_EOF) break;
+    }
+
+    piece->newlines = scanner.line - 1;
+}
+
+static void *worker(void *argument) {
+    LexJob *job = argument;
+
+    for (;;) {
+        int index = atomic_fetch_add(&job->next, 1);
+        if (index >= job->stream->piece_count) break;
+
+        tokenize_piece(&job->stream->pieces[index], index == job->stream->piece_count - 1);
+    }
+
+    return NULL;
+}
+
+bool tokenize_parallel(TokenStream *stream, const char *source, size_t length) {
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) workers = 1;
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+
+    // a few pieces per thread even out the load, as long as each one is worth a thread switch
+    int pieces = (int) workers * PIECES_PER_WORKER;
+    if ((size_t) pieces > length / MIN_PIECE_BYTES) pieces = (int) (length / MIN_PIECE_BYTES);
+    if (pieces < 1) pieces = 1;
+
+    const char *splits[MAX_WORKERS * PIECES_PER_WORKER];
+    pieces = find_split_points(source, length, splits, pieces - 1) + 1;
+
+    stream->pieces = ALLOCATE(TokenPiece, pieces, MEMORY_TEMPORARY);
+    stream->piece_count = pieces;
+    stream->piece = 0;
+    stream->index = 0;
+    stream->first_line = 0;
+
+    for (int i = 0; i < pieces; i++) {
+        TokenPiece *piece = &stream->pieces[i];
+        piece->start = i == 0 ? source : splits[i - 1];
+        piece->end = i == pieces - 1 ? source + length : splits[i];
+        piece->tokens = NULL;
+        piece->count = 0;
+        piece->capacity = 0;
+        piece->errors = NULL;
+        piece->error_count = 0;
+        piece->error_capacity = 0;
+        piece->newlines = 0;
+
+        // token offsets are 32 bits wide
+        if ((size_t) (piece->end - piece->start) > UINT32_MAX) {
+            FREE_ARRAY(stream->pieces, TokenPiece, pieces, MEMORY_TEMPORARY);
+            stream->pieces = NULL;
+            stream->piece_count = 0;
+            return false;
+        }
+    }
+
+    LexJob job;
+    job.stream = stream;
+    atomic_init(&job.next, 0);
+
+    if (workers > pieces) workers = pieces;
+
+    pthread_t threads[MAX_WORKERS];
+    long started = 0;
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, worker, &job) != 0) break;
+    }
+
+    if (started == 0) worker(&job);
+
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return true;
+}
+
+Token next_token(TokenStream *stream) {
+    TokenPiece *piece = &stream->pieces[stream->piece];
+
+    while (stream->index == piece->count && stream->piece + 1 < stream->piece_count) {
+        stream->first_line += piece->newlines;
+        piece = &stream->pieces[++stream->piece];
+        stream->index = 0;
+    }
+
+    // the last piece ends with TOKEN_EOF, which is handed out again on every later call
+    PackedToken *packed = &piece->tokens[stream->index];
+    if (stream->index + 1 < piece->count || stream->piece + 1 < stream->piece_count) stream->index++;
+
+    Token token;
+    token.type = (TokenType) packed->type;
+    token.start = packed->type == TOKEN_ERROR ? piece->errors[packed->offset] : piece->start + packed->offset;
+    token.length = (int) packed->length;
+    token.line = stream->first_line + (int) packed->line;
+
+    return token;
+}
+
+long token_count(const TokenStream *stream) {
+    long count = 0;
+    for (int i = 0; i < stream->piece_count; i++) {
+        count += stream->pieces[i].count;
+    }
+
+    // without the final TOKEN_EOF
+    return count - 1;
+}
+
+void free_token_stream(TokenStream *stream) {
+    for (int i = 0; i < stream->piece_count; i++) {
+        TokenPiece *piece = &stream->pieces[i];
+
+        for (int j = 0; j < piece->error_count; j++) {
+            free(piece->errors[j]);
+        }
+
+        FREE_ARRAY(piece->errors, char *, piece->error_capacity, MEMORY_TEMPORARY);
+        FREE_ARRAY(piece->tokens, PackedToken, piece->capacity, MEMORY_TEMPORARY);
+    }
+
+    FREE_ARRAY(stream->pieces, TokenPiece, stream->piece_count, MEMORY_TEMPORARY);
+    stream->pieces = NULL;
+    stream->piece_count = 0;
+}
@@ -0,0 +1,48 @@
+#ifndef FILANG_LEXER_H
+#define FILANG_LEXER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "token.h"
+
+typedef struct {
+    uint32_t offset;    // from the start of the piece, index into the piece errors for TOKEN_ERROR
+    uint32_t length;
+    uint32_t line;      // counted from the first line of the piece
+    uint8_t type;
+} PackedToken;
+
+typedef struct {
+    const char *start;
+    const char *end;
+    PackedToken *tokens;
+    int count;
+    int capacity;
+    char **errors;      // messages of the error tokens, owned by the piece
+    int error_count;
+    int error_capacity;
+    int newlines;
+} TokenPiece;
+
+/*
+ * A source file split into pieces that are tokenized on separate threads and then read
+ * back in order by next_token(), which restores the line numbers of the whole file.
+ */
+typedef struct {
+    TokenPiece *pieces;
+    int piece_count;
+    int piece;          // piece being read
+    int index;          // next token of that piece
+    int first_line;     // line the piece being read starts on
+} TokenStream;
+
+bool tokenize_parallel(TokenStream *stream, const char *source, size_t length);
+
+Token next_token(TokenStream *stream);
+
+long token_count(const TokenStream *stream);
+
+void free_token_stream(TokenStream *stream);
+
+#endif //FILANG_LEXER_H
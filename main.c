@@ -3,34 +3,32 @@
 #include <stdbool.h>
 #include <string.h>
 #include <signal.h>
+#include <unistd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "vm.h"
+#include "batch.h"
+#include "compiler.h"
+#include "stats.h"
+#include "source_file.h"
+#include "pipeline.h"
+#include "bytecode.h"
+#include "snapshot.h"
 
-static char *read_from_file(char *file_path) {
-    FILE *file = fopen(file_path, "r");
+static Bytecode loaded;
+static BytecodeWriter emit_writer;
+static Snapshot restored;
+static Arena arena;
 
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file %s", file_path);
-        exit(1);
-    }
-
-    fseek(file, 0, SEEK_END);
-    long fileSize = ftell(file);
-    rewind(file);
-
-    char *buffer = (char *) malloc(fileSize + 1);
-    size_t bytes_read = fread(buffer, sizeof(char), fileSize, file);
-    buffer[fileSize] = '\0';
+static SourceFile open_source(char *file_path) {
+    SourceFile file;
 
-    if ((long) bytes_read < fileSize) {
+    if (!map_source_file(file_path, &file)) {
         fprintf(stderr, "Could not read file %s", file_path);
         exit(1);
     }
 
-    fclose(file);
-
-    return buffer;
+    return file;
 }
 
 static void signal_handler(int) {
@@ -60,31 +58,263 @@ static void repl() {
 
         add_history(line);
 
-        interpret(line);
+        interpret(line, strlen(line));
 
         free(line);
     }
 }
 
-static void run_file(char *fileName) {
+// loaded stays mapped until the VM is freed, its strings are interned in place
+static bool load_file(const char *path, InterpretResult *result) {
+    if (!load_bytecode(path, &loaded)) return false;
+
+    *result = interpret_bytecode(&loaded);
+    return true;
+}
+
+static bool run_file(char *fileName, bool use_cache) {
+    vm.repl = false;
+
+    if (is_bytecode_file(fileName)) {
+        InterpretResult result;
+        if (!load_file(fileName, &result)) {
+            fprintf(stderr, "Could not load bytecode file %s\n", fileName);
+            return false;
+        }
+        return result == NO_ERRORS;
+    }
+
+    register_script(fileName);
+    SourceFile file = open_source(fileName);
+    char *cache_path = NULL;
+    uint8_t digest[SOURCE_DIGEST_SIZE];
+
+    if (use_cache && file.length >= CACHE_MIN_BYTES) {
+        digest_source(file.chars, file.length, digest);
+        cache_path = bytecode_cache_path(digest);
+    }
+
+    if (cache_path != NULL && load_bytecode(cache_path, &loaded)) {
+        // the file name alone is not trusted, the digest it was written with has to match too
+        if (memcmp(loaded.source_digest, digest, SOURCE_DIGEST_SIZE) == 0 && loaded.source_length == file.length) {
+            unmap_source_file(&file);
+            InterpretResult result = interpret_bytecode(&loaded);
+            free(cache_path);
+            return result == NO_ERRORS;
+        }
+        unload_bytecode(&loaded);
+    }
+
+    BytecodeWriter writer;
+    bool caching = cache_path != NULL && open_bytecode_writer(&writer, cache_path, digest, file.length);
+
+    InterpretResult result = interpret_file(&file, caching ? &writer : NULL);
+
+    // a script that stopped early was not compiled to the end, its bytecode is incomplete
+    if (caching) close_bytecode_writer(&writer, result == NO_ERRORS);
+
+    free(cache_path);
+    unmap_source_file(&file);
+    return result == NO_ERRORS;
+}
+
+static bool snapshot_file(char *file_name, char *output, bool use_cache) {
+    if (!run_file(file_name, use_cache)) return false;
+
+    if (!write_snapshot(output)) {
+        fprintf(stderr, "Could not write %s\n", output);
+        return false;
+    }
+    return true;
+}
+
+static bool write_segment(Chunk *chunk, const char *) {
+    return write_bytecode_segment(&emit_writer, chunk);
+}
+
+static bool emit_file(char *file_name, char *output) {
+    SourceFile source = open_source(file_name);
+    uint8_t digest[SOURCE_DIGEST_SIZE];
+    digest_source(source.chars, source.length, digest);
+
+    if (!open_bytecode_writer(&emit_writer, output, digest, source.length)) {
+        fprintf(stderr, "Could not write %s\n", output);
+        unmap_source_file(&source);
+        return false;
+    }
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    bool compiled = compile_segments(&chunk, source.chars, source.length, &vm.strings, write_segment);
+    free_chunk(&chunk);
+
+    bool written = compiled && !emit_writer.failed;
+    if (!close_bytecode_writer(&emit_writer, written) || (compiled && !written)) {
+        fprintf(stderr, "Could not write %s\n", output);
+        written = false;
+    }
+
+    unmap_source_file(&source);
+    return written;
+}
+
+static bool run_stdin() {
     vm.repl = false;
-    char *sourceCode = read_from_file(fileName);
-    interpret(sourceCode);
+    return interpret_stream(STDIN_FILENO) == NO_ERRORS;
+}
+
+static bool compile_file(char *file_name, bool print_stats, bool parallel_lex) {
+    CompileStats stats;
+    init_compile_stats(&stats);
+
+    double start = now_seconds();
+    SourceFile source = open_source(file_name);
+    stats.read_time = now_seconds() - start;
+    stats.source_bytes = source.length;
+
+    if (print_stats && !parallel_lex) {
+        // scanning is interleaved with parsing, so it is timed on its own pass
+        start = now_seconds();
+        stats.tokens = count_tokens(source.chars, source.length);
+        stats.scan_time = now_seconds() - start;
+    }
+
+    Chunk chunk;
+    init_chunk(&chunk);
+
+    bool compiled = parallel_lex
+                    ? compile_parallel(&chunk, source.chars, source.length, &vm.strings, print_stats ? &stats : NULL)
+                    : compile_with_stats(&chunk, source.chars, source.length, &vm.strings, print_stats ? &stats : NULL);
+    if (compiled && print_stats) {
+        print_compile_stats(stdout, &stats, &chunk, &vm.strings);
+    }
+
+    free_chunk(&chunk);
+    unmap_source_file(&source);
+    return compiled;
 }
 
+static int usage() {
+    fprintf(stderr, "Usage: filang [--parallel-lex] [--no-cache] [--restore <snapshot>.fis] [--gc-threshold <bytes>]\n");
+    fprintf(stderr, "              [--memory-limit <bytes>] [--slab-stats] [--mem-stats] [--arena] <filepath>.fi\n");
+    fprintf(stderr, "       filang -    (runs the script piped to stdin as it arrives)\n");
+    fprintf(stderr, "       filang --compile-only [--stats] [--parallel-lex] <filepath>.fi\n");
+    fprintf(stderr, "       filang [--no-cache] --compile-all <directory>\n");
+    fprintf(stderr, "       filang --emit <output>.fic <filepath>.fi\n");
+    fprintf(stderr, "       filang <filepath>.fic\n");
+    fprintf(stderr, "       filang --snapshot <output>.fis <prelude>.fi\n");
+    return 1;
+}
 
 int main(int argc, char *argv[]) {
+    char *file = NULL;
+    char *compile_directory = NULL;
+    bool compile_only = false;
+    bool print_stats = false;
+    bool parallel_lex = false;
+    bool use_cache = true;
+    char *emit_path = NULL;
+    char *snapshot_path = NULL;
+    char *restore_path = NULL;
+    long long gc_threshold = -1;
+    long long memory_limit = 0;
+    bool slab_stats = false;
+    bool mem_stats = false;
+    bool use_arena = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compile-only") == 0) {
+            compile_only = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (strcmp(argv[i], "--parallel-lex") == 0) {
+            parallel_lex = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = false;
+        } else if (strcmp(argv[i], "--emit") == 0 && i + 1 < argc) {
+            emit_path = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_path = argv[++i];
+        } else if (strcmp(argv[i], "--arena") == 0) {
+            use_arena = true;
+        } else if (strcmp(argv[i], "--slab-stats") == 0) {
+            slab_stats = true;
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats = true;
+        } else if (strcmp(argv[i], "--gc-threshold") == 0 && i + 1 < argc) {
+            char *end;
+            gc_threshold = strtoll(argv[++i], &end, 10);
+            if (*end != '\0' || gc_threshold < 0) return usage();
+        } else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc) {
+            char *end;
+            memory_limit = strtoll(argv[++i], &end, 10);
+            if (*end != '\0' || memory_limit < 0) return usage();
+        } else if (strcmp(argv[i], "--compile-all") == 0 && i + 1 < argc) {
+            compile_directory = argv[++i];
+        } else if ((argv[i][0] == '-' && strcmp(argv[i], "-") != 0) || file != NULL) {
+            return usage();
+        } else {
+            file = argv[i];
+        }
+    }
+
+    if ((print_stats && !compile_only) || (compile_only && file == NULL) || (compile_directory != NULL && file != NULL) ||
+        (emit_path != NULL && (file == NULL || compile_only)) ||
+        (snapshot_path != NULL && (file == NULL || compile_only || emit_path != NULL || strcmp(file, "-") == 0))) {
+        return usage();
+    }
+
     init_vm();
+    vm.parallel_lex = parallel_lex;
+    if (use_arena) {
+        init_arena(&arena, vm.allocator);
+        vm.arena = &arena;
+    }
+    if (gc_threshold >= 0) {
+        vm.gc_threshold = (size_t) gc_threshold;
+        vm.next_gc = vm.gc_threshold;
+    }
+    vm.memory_limit = (size_t) memory_limit;
+    vm.memory_stats = mem_stats;
 
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
-    } else {
-        fprintf(stderr, "Usage: filang <filepath>.fi\n");
+    if (restore_path != NULL && !load_snapshot(restore_path, &restored)) {
+        fprintf(stderr, "Could not load snapshot %s\n", restore_path);
+        free_vm();
         return 1;
     }
 
+    int status = 0;
+    if (compile_directory != NULL) {
+        status = compile_all(compile_directory, use_cache) ? 0 : 1;
+    } else if (emit_path != NULL) {
+        status = emit_file(file, emit_path) ? 0 : 1;
+    } else if (snapshot_path != NULL) {
+        status = snapshot_file(file, snapshot_path, use_cache) ? 0 : 1;
+    } else if (compile_only) {
+        status = compile_file(file, print_stats, parallel_lex) ? 0 : 1;
+    } else if (file != NULL && strcmp(file, "-") == 0) {
+        status = run_stdin() ? 0 : 1;
+    } else if (file != NULL) {
+        run_file(file, use_cache);
+    } else {
+        repl();
+    }
+
+    // printed before the VM frees its objects, after the script and everything it left behind
+    if (slab_stats) {
+        fflush(stdout);
+        print_slab_stats(stderr, &vm.slabs);
+    }
+    if (mem_stats) {
+        fflush(stdout);
+        print_memory_stats(stderr);
+    }
+
     free_vm();
-    return 0;
+    if (use_arena) free_arena(&arena);
+    if (loaded.mapping != NULL) unload_bytecode(&loaded);
+    if (restored.mapping != NULL) unload_snapshot(&restored);
+    return status;
 }
@@ -1,18 +1,522 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include "memory.h"
+#include "vm.h"
 
-void *reallocate(void *pointer, size_t old_size, size_t new_size) {
+static void *system_reallocate(void *, void *pointer, size_t, size_t new_size) {
     if (new_size == 0) {
         free(pointer);
         return NULL;
     }
 
-    void *allocated_memory = realloc(pointer, new_size);
-    if (allocated_memory == NULL) {
+    return realloc(pointer, new_size);
+}
+
+const Allocator system_allocator = {system_reallocate, NULL};
+
+static void raise_peak(atomic_size_t *peak, size_t value) {
+    size_t seen = atomic_load_explicit(peak, memory_order_relaxed);
+    while (value > seen && !atomic_compare_exchange_weak_explicit(peak, &seen, value, memory_order_relaxed,
+                                                                  memory_order_relaxed)) {
+    }
+}
+
+static void count(MemoryCounters *counters, size_t old_size, size_t new_size) {
+    if (new_size != 0) atomic_fetch_add_explicit(&counters->allocations, 1, memory_order_relaxed);
+
+    if (new_size >= old_size) {
+        size_t current = atomic_fetch_add_explicit(&counters->current, new_size - old_size, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->total, new_size - old_size, memory_order_relaxed);
+        raise_peak(&counters->peak, current + new_size - old_size);
+    } else {
+        atomic_fetch_sub_explicit(&counters->current, old_size - new_size, memory_order_relaxed);
+    }
+}
+
+void account_memory(MemoryCategory category, size_t old_size, size_t new_size) {
+    if (vm.memory_stats) {
+        count(&vm.memory[category], old_size, new_size);
+        count(&vm.memory[MEMORY_CATEGORY_COUNT], old_size, new_size);
+    }
+
+    if (vm.memory_limit == 0) return;
+
+    if (new_size >= old_size) {
+        atomic_fetch_add_explicit(&vm.memory_used, new_size - old_size, memory_order_relaxed);
+    } else {
+        atomic_fetch_sub_explicit(&vm.memory_used, old_size - new_size, memory_order_relaxed);
+    }
+}
+
+// the slabs go through here, only the objects carved out of them are counted
+static void *reallocate_untracked(void *pointer, size_t old_size, size_t new_size) {
+    void *allocated_memory = vm.allocator.reallocate(vm.allocator.context, pointer, old_size, new_size);
+    if (allocated_memory == NULL && new_size != 0) {
+        fprintf(stderr, "Out of memory.\n");
         exit(1);
     }
 
     return allocated_memory;
 }
 
+void *reallocate(void *pointer, size_t old_size, size_t new_size, MemoryCategory category) {
+    account_memory(category, old_size, new_size);
+    return reallocate_untracked(pointer, old_size, new_size);
+}
+
+bool within_budget(size_t size) {
+    return vm.memory_limit == 0 ||
+           atomic_load_explicit(&vm.memory_used, memory_order_relaxed) + size <= vm.memory_limit;
+}
+
+static const char *category_names[MEMORY_CATEGORY_COUNT + 1] = {
+        "code", "lines", "constants", "locals", "entries", "strings", "temporary", "total"
+};
+
+const char *memory_category_name(MemoryCategory category) {
+    return category_names[category];
+}
+
+static MemoryStats read_counters(MemoryCounters *counters) {
+    return (MemoryStats) {
+            atomic_load_explicit(&counters->current, memory_order_relaxed),
+            atomic_load_explicit(&counters->peak, memory_order_relaxed),
+            atomic_load_explicit(&counters->total, memory_order_relaxed),
+            atomic_load_explicit(&counters->allocations, memory_order_relaxed)
+    };
+}
+
+MemoryStats memory_stats(MemoryCategory category) {
+    return read_counters(&vm.memory[category]);
+}
+
+// the last row is every category together, its peak is that of the sum
+void print_memory_stats(FILE *file) {
+    fprintf(file, "%-10s %12s %12s %14s %12s\n", "category", "current", "peak", "total", "allocations");
+
+    for (int i = 0; i <= MEMORY_CATEGORY_COUNT; i++) {
+        MemoryStats stats = read_counters(&vm.memory[i]);
+        fprintf(file, "%-10s %12zu %12zu %14zu %12zu\n", category_names[i], stats.current, stats.peak, stats.total,
+                stats.allocations);
+    }
+}
+
+#define ARENA_ALIGN(size) (((size) + 15) & ~(size_t) 15)
+#define ARENA_FIRST_BLOCK (1 << 16)
+#define ARENA_MAX_BLOCK (1 << 26)
+
+void init_arena(Arena *arena, Allocator parent) {
+    arena->parent = parent;
+    arena->blocks = NULL;
+    arena->bump = NULL;
+    arena->end = NULL;
+    arena->active = false;
+    atomic_flag_clear(&arena->lock);
+}
+
+static void lock_arena(Arena *arena) {
+    while (atomic_flag_test_and_set_explicit(&arena->lock, memory_order_acquire)) {
+    }
+}
+
+static void unlock_arena(Arena *arena) {
+    atomic_flag_clear_explicit(&arena->lock, memory_order_release);
+}
+
+static bool in_block(const ArenaBlock *block, const void *pointer) {
+    return (const char *) pointer >= (const char *) block && (const char *) pointer < (const char *) block + block->size;
+}
+
+static bool owns(Arena *arena, const void *pointer) {
+    for (ArenaBlock *block = arena->blocks; block != NULL; block = block->next) {
+        if (in_block(block, pointer)) return true;
+    }
+    return false;
+}
+
+bool in_arena(Arena *arena, const void *pointer) {
+    lock_arena(arena);
+    bool found = owns(arena, pointer);
+    unlock_arena(arena);
+    return found;
+}
+
+static void *bump(Arena *arena, size_t size) {
+    size = ARENA_ALIGN(size);
+
+    if (arena->bump == NULL || size > (size_t) (arena->end - arena->bump)) {
+        size_t block_size = arena->blocks == NULL ? ARENA_FIRST_BLOCK : arena->blocks->size * 2;
+        if (block_size > ARENA_MAX_BLOCK) block_size = ARENA_MAX_BLOCK;
+        if (block_size < size + ARENA_ALIGN(sizeof(ArenaBlock))) block_size = size + ARENA_ALIGN(sizeof(ArenaBlock));
+
+        ArenaBlock *block = arena->parent.reallocate(arena->parent.context, NULL, 0, block_size);
+        if (block == NULL) return NULL;
+
+        block->next = arena->blocks;
+        block->size = block_size;
+        arena->blocks = block;
+        arena->bump = (char *) block + ARENA_ALIGN(sizeof(ArenaBlock));
+        arena->end = (char *) block + block_size;
+    }
+
+    void *allocated = arena->bump;
+    arena->bump += size;
+    return allocated;
+}
+
+static void *arena_reallocate(void *context, void *pointer, size_t old_size, size_t new_size) {
+    Arena *arena = context;
+    lock_arena(arena);
+
+    void *allocated = NULL;
+    bool last = pointer != NULL && (char *) pointer + ARENA_ALIGN(old_size) == arena->bump;
+    bool foreign = pointer != NULL && !owns(arena, pointer);
+
+    if (foreign) {
+        // allocated before the arena was installed
+        if (new_size != 0) {
+            allocated = bump(arena, new_size);
+            if (allocated != NULL) memcpy(allocated, pointer, old_size < new_size ? old_size : new_size);
+        }
+        if (new_size == 0 || allocated != NULL) arena->parent.reallocate(arena->parent.context, pointer, old_size, 0);
+    } else if (new_size == 0) {
+        if (last) arena->bump = pointer;
+    } else if (last && ARENA_ALIGN(new_size) - ARENA_ALIGN(old_size) <= (size_t) (arena->end - arena->bump)) {
+        arena->bump = (char *) pointer + ARENA_ALIGN(new_size);
+        allocated = pointer;
+    } else {
+        allocated = bump(arena, new_size);
+        if (allocated != NULL && pointer != NULL) memcpy(allocated, pointer, old_size < new_size ? old_size : new_size);
+    }
+
+    unlock_arena(arena);
+    return allocated;
+}
+
+Allocator arena_allocator(Arena *arena) {
+    return (Allocator) {arena_reallocate, arena};
+}
+
+void reset_arena(Arena *arena) {
+    if (arena->blocks == NULL) return;
+
+    ArenaBlock *block = arena->blocks->next;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        arena->parent.reallocate(arena->parent.context, block, block->size, 0);
+        block = next;
+    }
+
+    arena->blocks->next = NULL;
+    arena->bump = (char *) arena->blocks + ARENA_ALIGN(sizeof(ArenaBlock));
+    arena->end = (char *) arena->blocks + arena->blocks->size;
+}
+
+void free_arena(Arena *arena) {
+    reset_arena(arena);
+    if (arena->blocks != NULL) arena->parent.reallocate(arena->parent.context, arena->blocks, arena->blocks->size, 0);
+    arena->blocks = NULL;
+    arena->bump = NULL;
+    arena->end = NULL;
+}
+
+static const size_t class_sizes[SLAB_CLASS_COUNT] = {32, 48, 64, 96, 128, 192, 256};
+
+// class of each size rounded up to 16 bytes
+static const uint8_t size_classes[SLAB_MAX_OBJECT / 16 + 1] = {
+        0, 0, 0, 1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6
+};
+
+void init_slabs(SlabAllocator *slabs) {
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        slabs->classes[i] = (SlabClass) {class_sizes[i], NULL, NULL, NULL, NULL, 0, 0, 0};
+    }
+    slabs->large_objects = 0;
+    slabs->large_bytes = 0;
+}
+
+static void *allocate_block(SlabClass *class) {
+    if (class->free_list != NULL) {
+        void *block = class->free_list;
+        class->free_list = *(void **) block;
+        return block;
+    }
+
+    if (class->bump + class->block_size > class->bump_end) {
+        Slab *slab = reallocate_untracked(NULL, 0, SLAB_BYTES);
+        slab->next = class->slabs;
+        class->slabs = slab;
+        class->slab_count++;
+        // blocks start 16 bytes in, the alignment malloc would have given them
+        class->bump = (char *) slab + 16;
+        class->bump_end = (char *) slab + SLAB_BYTES;
+    }
+
+    void *block = class->bump;
+    class->bump += class->block_size;
+    return block;
+}
+
+static bool arena_active() {
+    return vm.arena != NULL && vm.arena->active;
+}
 
+void *allocate_object(size_t size) {
+    // the slabs outlive the arena, objects allocated while it is installed come from it directly
+    if (arena_active()) return reallocate(NULL, 0, size, MEMORY_STRINGS);
+
+    if (size > SLAB_MAX_OBJECT) {
+        vm.slabs.large_objects++;
+        vm.slabs.large_bytes += size;
+        return reallocate(NULL, 0, size, MEMORY_STRINGS);
+    }
+
+    account_memory(MEMORY_STRINGS, 0, size);
+    SlabClass *class = &vm.slabs.classes[size_classes[(size + 15) / 16]];
+    class->blocks_in_use++;
+    class->bytes_requested += size;
+    return allocate_block(class);
+}
+
+void free_object_memory(void *object, size_t size) {
+    if (arena_active() && in_arena(vm.arena, object)) {
+        reallocate(object, size, 0, MEMORY_STRINGS);
+        return;
+    }
+
+    if (size > SLAB_MAX_OBJECT) {
+        vm.slabs.large_objects--;
+        vm.slabs.large_bytes -= size;
+        reallocate(object, size, 0, MEMORY_STRINGS);
+        return;
+    }
+
+    account_memory(MEMORY_STRINGS, size, 0);
+    SlabClass *class = &vm.slabs.classes[size_classes[(size + 15) / 16]];
+    class->blocks_in_use--;
+    class->bytes_requested -= size;
+    *(void **) object = class->free_list;
+    class->free_list = object;
+}
+
+void free_slabs(SlabAllocator *slabs) {
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        Slab *slab = slabs->classes[i].slabs;
+        while (slab != NULL) {
+            Slab *next = slab->next;
+            reallocate_untracked(slab, SLAB_BYTES, 0);
+            slab = next;
+        }
+    }
+    init_slabs(slabs);
+}
+
+void print_slab_stats(FILE *file, const SlabAllocator *slabs) {
+    fprintf(file, "%-8s %8s %12s %12s %10s %14s\n", "class", "slabs", "blocks", "in use", "occupancy",
+            "fragmentation");
+
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        const SlabClass *class = &slabs->classes[i];
+        if (class->slab_count == 0) continue;
+
+        // occupancy: slab space holding live objects, fragmentation: space inside those blocks left unused
+        size_t blocks = class->slab_count * ((SLAB_BYTES - 16) / class->block_size);
+        size_t used = class->blocks_in_use * class->block_size;
+        fprintf(file, "%-8zu %8zu %12zu %12zu %9.1f%% %13.1f%%\n", class->block_size, class->slab_count, blocks,
+                class->blocks_in_use, 100.0 * (double) used / (double) (class->slab_count * SLAB_BYTES),
+                used == 0 ? 0.0 : 100.0 * (1.0 - (double) class->bytes_requested / (double) used));
+    }
+
+    fprintf(file, "large    %8zu objects, %zu bytes\n", slabs->large_objects, slabs->large_bytes);
+}
+
+void track_object(Object *object, size_t size) {
+    object->next = vm.objects;
+    vm.objects = object;
+    vm.bytes_allocated += size;
+}
+
+static size_t object_size(Object *object) {
+    switch (object->type) {
+        case OBJ_STRING:
+            return STRING_SIZE(((ObjString *) object)->length);
+        case OBJ_ROPE:
+            return sizeof(ObjRope);
+        case OBJ_VIEW:
+            return sizeof(ObjView);
+    }
+    return 0;
+}
+
+static void free_object(Object *object) {
+    size_t size = object_size(object);
+    vm.bytes_allocated -= size;
+    free_object_memory(object, size);
+}
+
+// ropes are traced once the roots are marked, so that a long chain of them does not recurse
+static void mark_object(Object *object) {
+    if (object == NULL || object->external || object->marked) return;
+    object->marked = true;
+    if (object->type == OBJ_VIEW) mark_object((Object *) ((ObjView *) object)->parent);
+    if (object->type != OBJ_ROPE) return;
+
+    if (vm.gray.count + 1 > vm.gray.capacity) {
+        int old_capacity = vm.gray.capacity;
+        vm.gray.capacity = GROW_ARRAY_CAPACITY(old_capacity);
+        vm.gray.objects = GROW_ARRAY(vm.gray.objects, Object *, old_capacity, vm.gray.capacity, MEMORY_TEMPORARY);
+    }
+    vm.gray.objects[vm.gray.count++] = object;
+}
+
+static void mark_value(Value value) {
+    if (IS_OBJECT(value)) mark_object(AS_OBJECT(value));
+}
+
+static void trace_ropes() {
+    while (vm.gray.count > 0) {
+        ObjRope *rope = (ObjRope *) vm.gray.objects[--vm.gray.count];
+        mark_object(rope->left);
+        mark_object(rope->right);
+        mark_object((Object *) rope->flat);
+    }
+}
+
+static void mark_values(const Value *values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mark_value(values[i]);
+    }
+}
+
+static void mark_table(const Hashmap *map) {
+    for (int i = 0; i < map->capacity; i++) {
+        if (IS_EMPTY(map->entries[i])) continue;
+        mark_value(map->entries[i].key);
+        mark_value(map->entries[i].value);
+    }
+}
+
+static void mark_roots() {
+    mark_values(vm.stack, vm.stack_top - vm.stack);
+    mark_values(vm.locals.local, vm.locals.size);
+    mark_table(&vm.globals);
+    mark_table(&vm.modules);
+
+    if (vm.chunk != NULL) mark_values(vm.chunk->constants.values, vm.chunk->constants.count);
+    for (ChunkFrame *frame = vm.suspended; frame != NULL; frame = frame->previous) {
+        mark_values(frame->chunk->constants.values, frame->chunk->constants.count);
+    }
+}
+
+// vm.strings holds its strings weakly, an unmarked one is dropped from it as it is freed
+static void sweep() {
+    Object **link = &vm.objects;
+
+    while (*link != NULL) {
+        Object *object = *link;
+        if (object->marked) {
+            object->marked = false;
+            link = &object->next;
+            continue;
+        }
+
+        *link = object->next;
+        if (object->interned) erase_entry(&vm.strings, STRING_CAST(object));
+        free_object(object);
+    }
+}
+
+void collect_garbage() {
+    // objects in the arena are all freed together when it is left
+    if (arena_active()) return;
+
+    mark_roots();
+    trace_ropes();
+    sweep();
+
+    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    if (vm.next_gc < vm.gc_threshold) vm.next_gc = vm.gc_threshold;
+}
+
+void free_objects() {
+    Object *object = vm.objects;
+    while (object != NULL) {
+        Object *next = object->next;
+        free_object(object);
+        object = next;
+    }
+    vm.objects = NULL;
+    free_slabs(&vm.slabs);
+}
+
+void enter_arena() {
+    vm.heap_allocator = vm.allocator;
+    vm.allocator = arena_allocator(vm.arena);
+    vm.arena->active = true;
+}
+
+// a rope in the arena is flattened, its pieces may be in it too
+static Value promote(Value value) {
+    if (!IS_OBJECT(value) || !in_arena(vm.arena, AS_OBJECT(value))) return value;
+
+    ObjString *string = text_string_unchecked(value);
+    if (!in_arena(vm.arena, string)) return NEW_OBJECT(string);
+    return NEW_OBJECT(make_objstring(string->chars, string->length));
+}
+
+static void copy_out_of_arena(Hashmap *map) {
+    if (!in_arena(vm.arena, map->entries)) return;
+
+    Entry *entries = ALLOCATE(Entry, map->capacity, MEMORY_ENTRIES);
+    memcpy(entries, map->entries, sizeof(Entry) * map->capacity);
+    account_memory(MEMORY_ENTRIES, sizeof(Entry) * map->capacity, 0);
+    map->entries = entries;
+}
+
+// the copies hash the same as the originals, every entry stays in its slot
+static void promote_entry(Entry *entry) {
+    entry->key = promote(entry->key);
+    entry->value = promote(entry->value);
+}
+
+void leave_arena() {
+    vm.arena->active = false;
+    vm.allocator = vm.heap_allocator;
+
+    copy_out_of_arena(&vm.strings);
+    copy_out_of_arena(&vm.globals);
+    copy_out_of_arena(&vm.modules);
+
+    // nothing but the arena allocated objects since enter_arena(), they are all at the head of the list
+    while (vm.objects != NULL && in_arena(vm.arena, vm.objects)) {
+        Object *object = vm.objects;
+        if (object->interned) erase_entry(&vm.strings, STRING_CAST(object));
+        vm.bytes_allocated -= object_size(object);
+        account_memory(MEMORY_STRINGS, object_size(object), 0);
+        vm.objects = object->next;
+    }
+
+    // only the globals written since enter_arena() can refer to the arena
+    for (int i = 0; i < vm.arena_globals.count; i++) {
+        Entry *entry = get_entry(&vm.globals, vm.arena_globals.values[i]);
+        if (entry != NULL) promote_entry(entry);
+    }
+    account_memory(MEMORY_CONSTANTS, sizeof(Value) * vm.arena_globals.capacity, 0);
+    init_value_array(&vm.arena_globals);
+
+    for (int i = 0; i < vm.modules.capacity; i++) {
+        if (!IS_EMPTY(vm.modules.entries[i])) promote_entry(&vm.modules.entries[i]);
+    }
+
+    // no block is open once interpret() returns, the locals are all dead
+    if (in_arena(vm.arena, vm.locals.local)) {
+        account_memory(MEMORY_LOCALS, sizeof(Value) * vm.locals.capacity, 0);
+        vm.locals.local = NULL;
+        vm.locals.size = 0;
+        vm.locals.capacity = 0;
+    }
+
+    // the rest of what the arena holds went through reallocate() to be freed, it is no longer counted
+    reset_arena(vm.arena);
+}
@@ -1,20 +1,172 @@
 #ifndef FILANG_MEMORY_H
 #define FILANG_MEMORY_H
 
+#include <stdio.h>
 #include <stddef.h>
+#include <stdatomic.h>
 #include "value.h"
 
-void *reallocate(void *pointer, size_t old_size, size_t new_size);
+/*
+ * Every allocation of a VM goes through its allocator, with the semantics of realloc: a NULL pointer
+ * allocates, a new_size of 0 frees. It returns NULL when the memory could not be allocated. The compile
+ * threads of --parallel-lex and of scripts read from stdin call it too, so it must be thread-safe.
+ */
+typedef void *(*reallocate_fn)(void *context, void *pointer, size_t old_size, size_t new_size);
 
-#define ALLOCATE(type, count) (type*)reallocate(NULL, 0, sizeof(type)*count)
+typedef struct {
+    reallocate_fn reallocate;
+    void *context;
+} Allocator;
+
+extern const Allocator system_allocator;
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+} ArenaBlock;
+
+/*
+ * Allocates by bumping a pointer through blocks taken from parent, freeing only rolls back the latest
+ * allocation. Memory that was not allocated from the arena is handed back to parent when it is freed.
+ */
+typedef struct {
+    Allocator parent;
+    ArenaBlock *blocks;     // newest first
+    char *bump;
+    char *end;
+    bool active;            // installed as the VM's allocator
+    atomic_flag lock;       // held for a few instructions at a time, so it is spun on
+} Arena;
+
+void init_arena(Arena *arena, Allocator parent);
+
+Allocator arena_allocator(Arena *arena);
+
+bool in_arena(Arena *arena, const void *pointer);
+
+// frees everything allocated from the arena at once, the newest block is kept for reuse
+void reset_arena(Arena *arena);
+
+void free_arena(Arena *arena);
+
+// what an allocation is for, every allocation of the VM is counted under one of these
+typedef enum {
+    MEMORY_CODE,            // bytecode of the chunks
+    MEMORY_LINES,           // line tables of the chunks
+    MEMORY_CONSTANTS,
+    MEMORY_LOCALS,          // local variable slots of the VM and of the compilers
+    MEMORY_ENTRIES,         // hashmap entries
+    MEMORY_STRINGS,
+    MEMORY_TEMPORARY,       // tokens, jump lists and buffers that do not outlive a compilation
+    MEMORY_CATEGORY_COUNT
+} MemoryCategory;
+
+typedef struct {
+    size_t current;
+    size_t peak;
+    size_t total;           // every byte allocated so far, growths included
+    size_t allocations;     // calls that allocated or resized
+} MemoryStats;
+
+typedef struct {
+    atomic_size_t current;
+    atomic_size_t peak;
+    atomic_size_t total;
+    atomic_size_t allocations;
+} MemoryCounters;
+
+/*
+ * Allocations past vm.memory_limit still succeed, so that no structure is left half updated. The
+ * compiler and the VM check within_budget() once they are consistent again and stop with an error.
+ */
+void *reallocate(void *pointer, size_t old_size, size_t new_size, MemoryCategory category);
+
+// counts memory the VM did not get from reallocate(), such as the strings of a compiler's own table
+void account_memory(MemoryCategory category, size_t old_size, size_t new_size);
+
+// whether size more bytes fit in vm.memory_limit
+bool within_budget(size_t size);
+
+const char *memory_category_name(MemoryCategory category);
+
+// the figures of a category so far, all zero unless vm.memory_stats was set before allocating
+MemoryStats memory_stats(MemoryCategory category);
+
+void print_memory_stats(FILE *file);
+
+#define ALLOCATE(type, count, category) (type*)reallocate(NULL, 0, sizeof(type) * (count), category)
 
 #define GROW_ARRAY_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(array, type, old_count, new_count) \
-    (type*)reallocate(array, sizeof(type) * (old_count), sizeof(type) * (new_count))
+#define GROW_ARRAY(array, type, old_count, new_count, category) \
+    (type*)reallocate(array, sizeof(type) * (old_count), sizeof(type) * (new_count), category)
+
+#define FREE_ARRAY(array, type, old_count, category) \
+    reallocate(array, sizeof(type) * (old_count), 0, category)
+
+/*
+ * Objects up to SLAB_MAX_OBJECT bytes are carved out of SLAB_BYTES slabs, one set of slabs per
+ * size class, and go back to the free list of their class when freed. Larger ones are malloc'd.
+ */
+#define SLAB_BYTES (1 << 16)
+#define SLAB_MAX_OBJECT 256
+#define SLAB_CLASS_COUNT 7
+
+typedef struct Slab {
+    struct Slab *next;
+} Slab;
+
+typedef struct {
+    size_t block_size;
+    void *free_list;        // blocks freed, each holding a pointer to the next
+    char *bump;             // unused part of the newest slab
+    char *bump_end;
+    Slab *slabs;
+    size_t slab_count;
+    size_t blocks_in_use;
+    size_t bytes_requested; // by the objects in the blocks in use
+} SlabClass;
+
+typedef struct {
+    SlabClass classes[SLAB_CLASS_COUNT];
+    size_t large_objects;
+    size_t large_bytes;
+} SlabAllocator;
+
+void init_slabs(SlabAllocator *slabs);
+
+void *allocate_object(size_t size);
+
+// size must be the one the object was allocated with
+void free_object_memory(void *object, size_t size);
+
+void free_slabs(SlabAllocator *slabs);
+
+// occupancy and fragmentation of each size class
+void print_slab_stats(FILE *file, const SlabAllocator *slabs);
+
+#define GC_DEFAULT_THRESHOLD (1 << 20)
+#define GC_HEAP_GROW_FACTOR 2
+
+// hands object, of size bytes, over to the collector
+void track_object(Object *object, size_t size);
+
+/*
+ * Frees every object not reachable from the stack, the locals, the globals, the modules and the
+ * constants of the chunks being run, dropping the strings among them from vm.strings.
+ */
+void collect_garbage();
+
+void free_objects();
+
+// from here on the VM allocates from vm.arena and does not collect
+void enter_arena();
 
-#define FREE_ARRAY(array, type, old_count) \
-    reallocate(array, sizeof(type) * (old_count), 0)
+/*
+ * Copies the strings the globals and the modules still refer to out of the arena, drops the others
+ * from vm.strings and resets the arena.
+ */
+void leave_arena();
 
 #endif //FILANG_MEMORY_H
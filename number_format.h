@@ -0,0 +1,18 @@
+#ifndef FILANG_NUMBER_FORMAT_H
+#define FILANG_NUMBER_FORMAT_H
+
+#include <stdint.h>
+
+// enough for any number the formatters write, with its terminator
+#define NUMBER_BUFFER 32
+
+// both write into buffer, at least NUMBER_BUFFER bytes, and return the length written without the terminator
+int format_integer(int64_t value, char *buffer);
+
+/*
+ * Writes the fewest digits that read back as value, laid out as printf's "%g" would with
+ * a precision of 15: "0.1", "1e+15", "0.30000000000000004".
+ */
+int format_decimal(double value, char *buffer);
+
+#endif //FILANG_NUMBER_FORMAT_H
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "compiler.h"
+#include "strings.h"
+
+// segments compiled ahead of execution, more than that and the compiler waits
+#define MAX_PENDING_SEGMENTS 8
+
+typedef struct {
+    Chunk segments[MAX_PENDING_SEGMENTS];
+    int head;
+    int count;
+    bool finished;      // the compiler will not queue anything else
+    InterpretResult result;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} SegmentQueue;
+
+static SegmentQueue queue;
+static SourceStream input;
+
+static bool queue_segment(Chunk *chunk, const char *resume) {
+    release_source_stream(&input, resume);
+
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == MAX_PENDING_SEGMENTS && queue.result == NO_ERRORS) {
+        pthread_cond_wait(&queue.changed, &queue.lock);
+    }
+
+    bool running = queue.result == NO_ERRORS;
+    if (running) {
+        // the queue takes the code over, the compiler goes on with an empty chunk
+        queue.segments[(queue.head + queue.count) % MAX_PENDING_SEGMENTS] = *chunk;
+        queue.count++;
+        init_chunk(chunk);
+        pthread_cond_broadcast(&queue.changed);
+    }
+
+    pthread_mutex_unlock(&queue.lock);
+    return running;
+}
+
+// without a second thread each segment runs as soon as it is compiled
+static bool run_segment(Chunk *chunk, const char *resume) {
+    release_source_stream(&input, resume);
+
+    queue.result = execute_chunk(chunk);
+    fflush(stdout);
+    return queue.result == NO_ERRORS;
+}
+
+static void *executor(void *) {
+    for (;;) {
+        pthread_mutex_lock(&queue.lock);
+        while (queue.count == 0 && !queue.finished) {
+            pthread_cond_wait(&queue.changed, &queue.lock);
+        }
+
+        if (queue.count == 0) {
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+
+        Chunk segment = queue.segments[queue.head];
+        queue.head = (queue.head + 1) % MAX_PENDING_SEGMENTS;
+        queue.count--;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+
+        InterpretResult result = execute_chunk(&segment);
+        free_chunk(&segment);
+        fflush(stdout);
+
+        if (result != NO_ERRORS) {
+            pthread_mutex_lock(&queue.lock);
+            queue.result = result;
+            pthread_cond_broadcast(&queue.changed);
+            pthread_mutex_unlock(&queue.lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+InterpretResult interpret_stream(int descriptor) {
+    if (!open_source_stream(descriptor, &input)) {
+        fprintf(stderr, "Could not reserve memory for the input\n");
+        return COMPILE_ERROR;
+    }
+
+    queue.head = 0;
+    queue.count = 0;
+    queue.finished = false;
+    queue.result = NO_ERRORS;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+
+    pthread_t thread;
+    bool threaded = pthread_create(&thread, NULL, executor, NULL) == 0;
+
+    // the compiler interns in a table of its own, vm.strings belongs to the executor
+    Hashmap strings;
+    init_hashmap(&strings);
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    bool compiled = compile_stream(&chunk, &input, &strings, threaded ? queue_segment : run_segment);
+    free_chunk(&chunk);
+
+    pthread_mutex_lock(&queue.lock);
+    queue.finished = true;
+    pthread_cond_broadcast(&queue.changed);
+    pthread_mutex_unlock(&queue.lock);
+
+    if (threaded) pthread_join(thread, NULL);
+
+    // what was queued after a runtime error is never run
+    for (; queue.count > 0; queue.count--) {
+        free_chunk(&queue.segments[queue.head]);
+        queue.head = (queue.head + 1) % MAX_PENDING_SEGMENTS;
+    }
+
+    free_strings(&strings);
+    close_source_stream(&input);
+    pthread_cond_destroy(&queue.changed);
+    pthread_mutex_destroy(&queue.lock);
+
+    if (!compiled) return COMPILE_ERROR;
+    return queue.result;
+}
@@ -0,0 +1,12 @@
+#ifndef FILANG_PIPELINE_H
+#define FILANG_PIPELINE_H
+
+#include "vm.h"
+
+/*
+ * Runs a script while it is still being read from descriptor: statements are compiled as soon
+ * as they arrive and executed on a second thread, so compilation overlaps execution.
+ */
+InterpretResult interpret_stream(int descriptor);
+
+#endif //FILANG_PIPELINE_H
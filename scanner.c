@@ -1,57 +1,170 @@
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <malloc.h>
 #include <ctype.h>
 #include "scanner.h"
 #include "token.h"
 
-typedef struct {
-    const char *start;
-    const char *current;
-    int line;
-} Scanner;
+/*
+ * Whitespace, comments and string bodies are skipped a vector at a time. Loads are aligned,
+ * so a vector never crosses into the page after the end of the source, which needs no terminator.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 32
+#define SIMD_FULL_MASK 0xFFFFFFFFu
+typedef __m256i simd_vector;
+#define SIMD_LOAD(pointer) _mm256_load_si256((const __m256i *) (pointer))
+#define SIMD_MATCH(vector, c) ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(vector, _mm256_set1_epi8(c))))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 16
+#define SIMD_FULL_MASK 0xFFFFu
+typedef __m128i simd_vector;
+#define SIMD_LOAD(pointer) _mm_load_si128((const __m128i *) (pointer))
+#define SIMD_MATCH(vector, c) ((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(vector, _mm_set1_epi8(c))))
+#endif
+
+#define KEYWORD_HASH(first, last, length) (((first) + (last) * 19 + (length)) & 31)
+
+// perfect hash on first character, last character and length, laid out by the compiler
+static const struct {
+    const char *name;
+    int length;
+    TokenType type;
+} keywords[32] = {
+        [KEYWORD_HASH('a', 'd', 3)] = {"and", 3, TOKEN_AND},
+        [KEYWORD_HASH('o', 'r', 2)] = {"or", 2, TOKEN_OR},
+        [KEYWORD_HASH('i', 'f', 2)] = {"if", 2, TOKEN_IF},
+        [KEYWORD_HASH('e', 'e', 4)] = {"else", 4, TOKEN_ELSE},
+        [KEYWORD_HASH('p', 't', 5)] = {"print", 5, TOKEN_PRINT},
+        [KEYWORD_HASH('r', 'n', 6)] = {"return", 6, TOKEN_RETURN},
+        [KEYWORD_HASH('f', 'e', 5)] = {"false", 5, TOKEN_FALSE},
+        [KEYWORD_HASH('t', 'e', 4)] = {"true", 4, TOKEN_TRUE},
+        [KEYWORD_HASH('t', 'f', 6)] = {"typeof", 6, TOKEN_TYPEOF},
+        [KEYWORD_HASH('n', 'l', 3)] = {"nil", 3, TOKEN_NIL},
+        [KEYWORD_HASH('n', 't', 3)] = {"not", 3, TOKEN_NOT},
+        [KEYWORD_HASH('c', 'k', 5)] = {"clock", 5, TOKEN_CLOCK},
+        [KEYWORD_HASH('i', 't', 6)] = {"import", 6, TOKEN_IMPORT},
+};
+
+void init_scanner(Scanner *scanner, const char *source, size_t length) {
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + length;
+    scanner->line = 1;
+    scanner->interpolation_depth = 0;
+}
 
-Scanner scanner;
+static bool is_at_end(Scanner *scanner) {
+    return scanner->current >= scanner->end;
+}
 
-void init_scanner(const char *source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+static char peek(Scanner *scanner) {
+    if (is_at_end(scanner)) return '\0';
+    return *scanner->current;
 }
 
-static bool is_at_end() {
-    return *scanner.current == '\0';
+static char advance(Scanner *scanner) {
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-static char peek() {
-    return *scanner.current;
+static char peek_next(Scanner *scanner) {
+    if (scanner->current + 1 >= scanner->end) return '\0';
+    return scanner->current[1];
 }
 
-static char advance() {
-    scanner.current++;
-    return scanner.current[-1];
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
 }
 
-static char peek_next() {
-    if (is_at_end()) return '\0';
-    return scanner.current[1];
+// first character after a run of blanks, counting the newlines it skips
+__attribute__((no_sanitize_address))
+static const char *skip_blanks(const char *current, const char *end, int *line) {
+#ifdef SIMD_WIDTH
+    uintptr_t misalignment = (uintptr_t) current & (SIMD_WIDTH - 1);
+    const char *block = current - misalignment;
+    uint32_t valid = (SIMD_FULL_MASK << misalignment) & SIMD_FULL_MASK;
+
+    for (;;) {
+        if (end - block < SIMD_WIDTH) valid &= (1u << (end - block)) - 1;
+
+        simd_vector bytes = SIMD_LOAD(block);
+        uint32_t newlines = SIMD_MATCH(bytes, '\n');
+        uint32_t blanks = SIMD_MATCH(bytes, ' ') | SIMD_MATCH(bytes, '\t') | SIMD_MATCH(bytes, '\r') | newlines;
+        uint32_t others = ~blanks & valid;
+
+        if (others != 0) {
+            int index = __builtin_ctz(others);
+            *line += __builtin_popcount(newlines & valid & ((1u << index) - 1));
+            return block + index;
+        }
+
+        *line += __builtin_popcount(newlines & valid);
+        block += SIMD_WIDTH;
+        if (block >= end) return end;
+        valid = SIMD_FULL_MASK;
+    }
+#else
+    while (current < end && is_blank(*current)) {
+        if (*current == '\n') (*line)++;
+        current++;
+    }
+    return current;
+#endif
+}
+
+// first occurrence of one of a, b, c or d, end if there is none
+__attribute__((no_sanitize_address))
+static const char *find_any(const char *current, const char *end, char a, char b, char c, char d) {
+    if (current >= end) return end;
+
+#ifdef SIMD_WIDTH
+    uintptr_t misalignment = (uintptr_t) current & (SIMD_WIDTH - 1);
+    const char *block = current - misalignment;
+    uint32_t valid = (SIMD_FULL_MASK << misalignment) & SIMD_FULL_MASK;
+
+    for (;;) {
+        if (end - block < SIMD_WIDTH) valid &= (1u << (end - block)) - 1;
+
+        simd_vector bytes = SIMD_LOAD(block);
+        uint32_t found = (SIMD_MATCH(bytes, a) | SIMD_MATCH(bytes, b) | SIMD_MATCH(bytes, c) |
+                          SIMD_MATCH(bytes, d)) & valid;
+
+        if (found != 0) {
+            return block + __builtin_ctz(found);
+        }
+
+        block += SIMD_WIDTH;
+        if (block >= end) return end;
+        valid = SIMD_FULL_MASK;
+    }
+#else
+    while (current < end && *current != a && *current != b && *current != c && *current != d) current++;
+    return current;
+#endif
 }
 
-static void skip_whitespace() {
+static void skip_whitespace(Scanner *scanner) {
     for (;;) {
-        char c = peek();
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
-                break;
             case '\n':
-                scanner.line++;
-                advance();
+                // single separators are the common case, only runs are worth a vector scan
+                if (!is_blank(peek_next(scanner))) {
+                    if (c == '\n') scanner->line++;
+                    advance(scanner);
+                } else {
+                    scanner->current = skip_blanks(scanner->current, scanner->end, &scanner->line);
+                }
                 break;
             case '#':
-                while (peek() != '\n' && !is_at_end()) advance();
+                scanner->current = find_any(scanner->current, scanner->end, '\n', '\n', '\n', '\n');
                 break;
             default:
                 return;
@@ -63,95 +176,59 @@ static bool is_alpha(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '_');
 }
 
-static Token make_token(TokenType type) {
+static Token make_token(Scanner *scanner, TokenType type) {
     Token token;
 
     token.type = type;
-    token.start = scanner.start;
-    token.line = scanner.line;
-    token.length = (int) (scanner.current - scanner.start);
+    token.start = scanner->start;
+    token.line = scanner->line;
+    token.length = (int) (scanner->current - scanner->start);
 
     return token;
 }
 
-static Token number() {
+static Token number(Scanner *scanner) {
     bool is_float = false;
 
-    while (isdigit(peek())) advance();
+    while (isdigit(peek(scanner))) advance(scanner);
 
-    if (peek() == '.' && isdigit(peek_next())) {
+    if (peek(scanner) == '.' && isdigit(peek_next(scanner))) {
         is_float = true;
-        advance();
-        while (isdigit(peek())) advance();
+        advance(scanner);
+        while (isdigit(peek(scanner))) advance(scanner);
     }
 
-    return is_float ? make_token(TOKEN_FLOAT) : make_token(TOKEN_INTEGER);
+    return is_float ? make_token(scanner, TOKEN_FLOAT) : make_token(scanner, TOKEN_INTEGER);
 }
 
-bool check_keyword(char *expected) {
-    int i = 0;
-    while (is_alpha(peek()) || isdigit(peek()) || i < (int) strlen(expected)) {
-        if (expected[i] != peek()) {
-            return false;
-        }
-        advance();
-        i++;
-    }
-    return true;
-}
+#define IDENTIFIER_RANGE(from, to) [from ... to] = true
 
-static Token identifier() {
-    switch (scanner.start[0]) {
-        case 'a':
-            if (check_keyword("nd")) return make_token(TOKEN_AND);
-            break;
-        case 'o':
-            if (check_keyword("r")) return make_token(TOKEN_OR);
-            break;
-        case 'i':
-            if (check_keyword("f")) return make_token(TOKEN_IF);
-            break;
-        case 'e':
-            if (check_keyword("lse")) return make_token(TOKEN_ELSE);
-            break;
-        case 'p':
-            if (check_keyword("rint")) return make_token(TOKEN_PRINT);
-            break;
-        case 'r':
-            if (check_keyword("eturn")) return make_token(TOKEN_RETURN);
-            break;
-        case 'f':
-            if (check_keyword("alse")) return make_token(TOKEN_FALSE);
-            break;
-        case 't':
-            if (check_keyword("rue")) return make_token(TOKEN_TRUE);
-            if (check_keyword("ypeof")) return make_token(TOKEN_TYPEOF);
-            break;
-        case 'n':
-            if (check_keyword("il")) return make_token(TOKEN_NIL);
-            if (check_keyword("ot")) return make_token(TOKEN_NOT);
-            break;
-        case 'c':
-            if (check_keyword("lock")) return make_token(TOKEN_CLOCK);
-            break;
+static const bool identifier_chars[UINT8_MAX + 1] = {
+        IDENTIFIER_RANGE('a', 'z'), IDENTIFIER_RANGE('A', 'Z'), IDENTIFIER_RANGE('0', '9'), ['_'] = true
+};
 
-    }
+static Token identifier(Scanner *scanner) {
+    while (identifier_chars[(uint8_t) peek(scanner)]) advance(scanner);
 
+    int length = (int) (scanner->current - scanner->start);
+    int hash = KEYWORD_HASH(scanner->start[0], scanner->current[-1], length);
 
-    while (is_alpha(peek()) || isdigit(peek())) advance();
+    if (keywords[hash].length == length && memcmp(keywords[hash].name, scanner->start, length) == 0) {
+        return make_token(scanner, keywords[hash].type);
+    }
 
-    return make_token(TOKEN_IDENTIFIER);
+    return make_token(scanner, TOKEN_IDENTIFIER);
 }
 
-static bool match(char expected) {
-    if (is_at_end()) return false;
-    if (*scanner.current != expected) return false;
+static bool match(Scanner *scanner, char expected) {
+    if (is_at_end(scanner)) return false;
+    if (*scanner->current != expected) return false;
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-static Token error_token(char *error_message, const char *error_char) {
+static Token error_token(Scanner *scanner, char *error_message, const char *error_char) {
     Token token;
     char *error = malloc(strlen(error_message) + strlen(error_char) + 1);
     strcpy(error, error_message);
@@ -159,113 +236,233 @@ static Token error_token(char *error_message, const char *error_char) {
     strcat(error, "\0");
     token.start = error;
     token.length = (int) strlen(error);
-    token.line = scanner.line;
+    token.line = scanner->line;
     token.type = TOKEN_ERROR;
 
     return token;
 }
 
-static Token string(char terminator) {
-    while (peek() != terminator) {
-        if (is_at_end()) return error_token("Unterminated string.", "");
-        if (peek() == '\n') scanner.line++;
-        if (peek() == '\\') advance();
-        advance();
+/*
+ * Scans a string body up to its terminator, or up to a "${" that starts an interpolated
+ * expression: the expression tokens follow and the matching '}' resumes the string.
+ */
+static Token string(Scanner *scanner, char terminator) {
+    for (;;) {
+        // plain characters are skipped in one go, up to the next one that needs a look
+        scanner->current = find_any(scanner->current, scanner->end, terminator, '\\', '\n', '$');
+        if (peek(scanner) == terminator) break;
+
+        if (is_at_end(scanner)) return error_token(scanner, "Unterminated string.", "");
+
+        if (peek(scanner) == '$' && peek_next(scanner) == '{') {
+            if (scanner->interpolation_depth >= MAX_INTERPOLATION_DEPTH) {
+                return error_token(scanner, "Interpolation nested too deeply.", "");
+            }
+
+            advance(scanner);
+            advance(scanner);
+            scanner->interpolations[scanner->interpolation_depth].terminator = terminator;
+            scanner->interpolations[scanner->interpolation_depth].braces = 0;
+            scanner->interpolation_depth++;
+            return make_token(scanner, TOKEN_INTERPOLATION);
+        }
+
+        // an escaped character never ends the string nor starts an interpolation
+        if (peek(scanner) == '\\') advance(scanner);
+        if (is_at_end(scanner)) continue;
+        if (peek(scanner) == '\n') scanner->line++;
+        advance(scanner);
     }
 
-    advance();
-    return make_token(TOKEN_STRING);
+    advance(scanner);
+    return make_token(scanner, TOKEN_STRING);
 }
 
-Token scan_token() {
-    skip_whitespace();
-    scanner.start = scanner.current;
+Token scan_token(Scanner *scanner) {
+    skip_whitespace(scanner);
+    scanner->start = scanner->current;
 
-    if (is_at_end()) return make_token(TOKEN_EOF);
+    if (is_at_end(scanner)) return make_token(scanner, TOKEN_EOF);
 
-    char c = advance();
+    char c = advance(scanner);
 
-    if (isdigit(c)) return number();
-    if (is_alpha(c)) return identifier();
+    if (isdigit(c)) return number(scanner);
+    if (is_alpha(c)) return identifier(scanner);
 
     switch (c) {
         case '(':
-            return make_token(TOKEN_LEFT_PAREN);
+            return make_token(scanner, TOKEN_LEFT_PAREN);
         case ')':
-            return make_token(TOKEN_RIGHT_PAREN);
+            return make_token(scanner, TOKEN_RIGHT_PAREN);
         case '{':
-            return make_token(TOKEN_LEFT_BRACE);
+            if (scanner->interpolation_depth > 0) {
+                scanner->interpolations[scanner->interpolation_depth - 1].braces++;
+            }
+            return make_token(scanner, TOKEN_LEFT_BRACE);
         case '}':
-            return make_token(TOKEN_RIGHT_BRACE);
+            if (scanner->interpolation_depth > 0) {
+                if (scanner->interpolations[scanner->interpolation_depth - 1].braces == 0) {
+                    scanner->interpolation_depth--;
+                    return string(scanner, scanner->interpolations[scanner->interpolation_depth].terminator);
+                }
+                scanner->interpolations[scanner->interpolation_depth - 1].braces--;
+            }
+            return make_token(scanner, TOKEN_RIGHT_BRACE);
+        case '[':
+            return make_token(scanner, TOKEN_LEFT_BRACKET);
+        case ']':
+            return make_token(scanner, TOKEN_RIGHT_BRACKET);
         case ',':
-            return make_token(TOKEN_COMMA);
+            return make_token(scanner, TOKEN_COMMA);
         case '.':
-            return make_token(TOKEN_DOT);
+            return make_token(scanner, TOKEN_DOT);
         case '-':
-            return make_token(TOKEN_MINUS);
+            return make_token(scanner, TOKEN_MINUS);
         case '+':
-            return make_token(TOKEN_PLUS);
+            return make_token(scanner, TOKEN_PLUS);
         case '*':
-            if (match('*')) {
-                return make_token(TOKEN_STAR_STAR);
+            if (match(scanner, '*')) {
+                return make_token(scanner, TOKEN_STAR_STAR);
             } else {
-                return make_token(TOKEN_STAR);
+                return make_token(scanner, TOKEN_STAR);
             }
         case '/':
-            return make_token(TOKEN_SLASH);
+            return make_token(scanner, TOKEN_SLASH);
         case '%':
-            return make_token(TOKEN_PERCENT);
+            return make_token(scanner, TOKEN_PERCENT);
         case ';':
-            return make_token(TOKEN_SEMICOLON);
+            return make_token(scanner, TOKEN_SEMICOLON);
         case ':':
-            return make_token(TOKEN_COLONS);
+            return make_token(scanner, TOKEN_COLONS);
         case '?':
-            return make_token(TOKEN_INTERROGATION);
+            return make_token(scanner, TOKEN_INTERROGATION);
         case '=':
-            if (match('=')) {
-                return make_token(TOKEN_EQUAL_EQUAL);
+            if (match(scanner, '=')) {
+                return make_token(scanner, TOKEN_EQUAL_EQUAL);
             } else {
-                return make_token(TOKEN_EQUAL);
+                return make_token(scanner, TOKEN_EQUAL);
             }
         case '!':
-            if (match('=')) {
-                return make_token(TOKEN_BANG_EQUAL);
+            if (match(scanner, '=')) {
+                return make_token(scanner, TOKEN_BANG_EQUAL);
             } else {
-                return error_token("Unexpected character", "!");
+                return error_token(scanner, "Unexpected character", "!");
             }
         case '>':
-            if (match('=')) {
-                return make_token(TOKEN_GREATER_EQUAL);
-            } else if (match('>')) {
-                return make_token(TOKEN_GREATER_GREATER);
+            if (match(scanner, '=')) {
+                return make_token(scanner, TOKEN_GREATER_EQUAL);
+            } else if (match(scanner, '>')) {
+                return make_token(scanner, TOKEN_GREATER_GREATER);
             } else {
-                return make_token(TOKEN_GREATER);
+                return make_token(scanner, TOKEN_GREATER);
             }
         case '<':
-            if (match('=')) {
-                return make_token(TOKEN_LESS_EQUAL);
-            } else if (match('<')) {
-                return make_token(TOKEN_LESS_LESS);
+            if (match(scanner, '=')) {
+                return make_token(scanner, TOKEN_LESS_EQUAL);
+            } else if (match(scanner, '<')) {
+                return make_token(scanner, TOKEN_LESS_LESS);
             } else {
-                return make_token(TOKEN_LESS);
+                return make_token(scanner, TOKEN_LESS);
             }
         case '^':
-            return make_token(TOKEN_CARET);
+            return make_token(scanner, TOKEN_CARET);
         case '|':
-            return make_token(TOKEN_PIPE);
+            return make_token(scanner, TOKEN_PIPE);
         case '&':
-            return make_token(TOKEN_AMPERSAND);
+            return make_token(scanner, TOKEN_AMPERSAND);
         case '~':
-            return make_token(TOKEN_TILDE);
+            return make_token(scanner, TOKEN_TILDE);
         case '"' :
         case '\'':
-            return string(c);
+            return string(scanner, c);
         default:
             if (isprint(c)) {
-                return error_token("Unexpected character: ", (char[4]) {'\'', c, '\'', '.'});
+                return error_token(scanner, "Unexpected character: ", (char[5]) {'\'', c, '\'', '.'});
             }
 
-            return error_token("Unexpected character.", "");
+            return error_token(scanner, "Unexpected character.", "");
     }
 }
 
+
+int find_split_points(const char *source, size_t length, const char **splits, int count) {
+    const char *end = source + length;
+    const char *current = source;
+    char terminator = '\0';     // quote of the string being skipped, '\0' outside strings
+    struct {
+        char terminator;
+        int braces;
+    } interpolations[MAX_INTERPOLATION_DEPTH];
+    int depth = 0;
+    int found = 0;
+
+    while (found < count && current < end) {
+        if (terminator != '\0') {
+            current = find_any(current, end, terminator, '\\', '$', terminator);
+            if (current >= end) break;
+
+            if (*current == '\\') {
+                current += current + 1 < end ? 2 : 1;
+            } else if (*current == '$') {
+                if (current + 1 < end && current[1] == '{' && depth < MAX_INTERPOLATION_DEPTH) {
+                    interpolations[depth].terminator = terminator;
+                    interpolations[depth].braces = 0;
+                    depth++;
+                    terminator = '\0';
+                    current++;
+                }
+                current++;
+            } else {
+                terminator = '\0';
+                current++;
+            }
+            continue;
+        }
+
+        if (depth == 0) {
+            // everything up to the next quote or comment is plain code, any ';' in it is a statement end
+            const char *next = find_any(current, end, '"', '\'', '#', '#');
+
+            while (found < count) {
+                const char *from = source + length * (found + 1) / (count + 1);
+                if (from < current) from = current;
+                if (found > 0 && from < splits[found - 1]) from = splits[found - 1];
+                if (from >= next) break;
+
+                const char *semicolon = memchr(from, ';', next - from);
+                if (semicolon == NULL) break;
+                splits[found++] = semicolon + 1;
+            }
+
+            current = next;
+            if (current >= end) break;
+        }
+
+        char c = *current++;
+        switch (c) {
+            case '"':
+            case '\'':
+                terminator = c;
+                break;
+            case '#':
+                current = find_any(current, end, '\n', '\n', '\n', '\n');
+                break;
+            case '{':
+                if (depth > 0) interpolations[depth - 1].braces++;
+                break;
+            case '}':
+                if (depth > 0) {
+                    if (interpolations[depth - 1].braces == 0) {
+                        terminator = interpolations[--depth].terminator;
+                    } else {
+                        interpolations[depth - 1].braces--;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return found;
+}
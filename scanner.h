@@ -1,10 +1,33 @@
 #ifndef FILANG_SCANNER_H
 #define FILANG_SCANNER_H
 
+#include <stddef.h>
 #include "token.h"
 
-void init_scanner(const char *source);
+#define MAX_INTERPOLATION_DEPTH 16
 
-Token scan_token();
+typedef struct {
+    const char *start;
+    const char *current;
+    const char *end;
+    int line;
+    // strings whose "${" expression is being scanned, innermost last
+    struct {
+        char terminator;
+        int braces;
+    } interpolations[MAX_INTERPOLATION_DEPTH];
+    int interpolation_depth;
+} Scanner;
+
+void init_scanner(Scanner *scanner, const char *source, size_t length);
+
+Token scan_token(Scanner *scanner);
+
+/*
+ * Picks up to count points, spread evenly over source, right after a ';' that is outside any
+ * string, comment or interpolation, so that the pieces between them scan on their own.
+ * Returns how many were found.
+ */
+int find_split_points(const char *source, size_t length, const char **splits, int count);
 
 #endif //FILANG_SCANNER_H
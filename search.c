@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <string.h>
+#include "search.h"
+
+/*
+ * Candidates are filtered a vector at a time on the first and the last byte of the needle, only positions
+ * where both match are compared in full. Loads are unaligned and never reach past the haystack,
+ * the positions left over at its end are searched one at a time.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 32
+typedef __m256i simd_vector;
+#define SIMD_LOAD(pointer) _mm256_loadu_si256((const __m256i *) (pointer))
+#define SIMD_SPLAT(c) _mm256_set1_epi8(c)
+#define SIMD_MATCH(vector, splat) ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(vector, splat)))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 16
+typedef __m128i simd_vector;
+#define SIMD_LOAD(pointer) _mm_loadu_si128((const __m128i *) (pointer))
+#define SIMD_SPLAT(c) _mm_set1_epi8(c)
+#define SIMD_MATCH(vector, splat) ((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(vector, splat)))
+#endif
+
+int search_text(const char *haystack, int length, const char *needle, int needle_length) {
+    if (needle_length == 0) return 0;
+    if (needle_length > length) return -1;
+
+    // memchr already filters a vector at a time
+    if (needle_length == 1) {
+        const char *found = memchr(haystack, needle[0], length);
+        return found == NULL ? -1 : (int) (found - haystack);
+    }
+
+    int candidates = length - needle_length + 1;
+    int start = 0;
+
+#ifdef SIMD_WIDTH
+    simd_vector first = SIMD_SPLAT(needle[0]);
+    simd_vector last = SIMD_SPLAT(needle[needle_length - 1]);
+
+    for (; candidates - start >= SIMD_WIDTH; start += SIMD_WIDTH) {
+        uint32_t found = SIMD_MATCH(SIMD_LOAD(haystack + start), first) &
+                         SIMD_MATCH(SIMD_LOAD(haystack + start + needle_length - 1), last);
+
+        while (found != 0) {
+            int index = start + __builtin_ctz(found);
+            if (memcmp(haystack + index + 1, needle + 1, needle_length - 2) == 0) return index;
+            found &= found - 1;
+        }
+    }
+#endif
+
+    while (start < candidates) {
+        const char *found = memchr(haystack + start, needle[0], candidates - start);
+        if (found == NULL) return -1;
+
+        int index = (int) (found - haystack);
+        if (memcmp(found + 1, needle + 1, needle_length - 1) == 0) return index;
+        start = index + 1;
+    }
+
+    return -1;
+}
+
+// every match of a single byte is counted, a vector of them at a time
+static int count_byte(const char *haystack, int length, char c) {
+    int count = 0;
+    int i = 0;
+
+#ifdef SIMD_WIDTH
+    simd_vector splat = SIMD_SPLAT(c);
+    for (; length - i >= SIMD_WIDTH; i += SIMD_WIDTH) {
+        count += __builtin_popcount(SIMD_MATCH(SIMD_LOAD(haystack + i), splat));
+    }
+#endif
+
+    for (; i < length; i++) {
+        count += haystack[i] == c;
+    }
+
+    return count;
+}
+
+int count_text(const char *haystack, int length, const char *needle, int needle_length) {
+    if (needle_length == 0) return length + 1;
+    if (needle_length == 1) return count_byte(haystack, length, needle[0]);
+
+    int count = 0;
+    for (int start = 0;;) {
+        int found = search_text(haystack + start, length - start, needle, needle_length);
+        if (found < 0) return count;
+
+        count++;
+        start += found + needle_length;
+    }
+}
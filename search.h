@@ -0,0 +1,10 @@
+#ifndef FILANG_SEARCH_H
+#define FILANG_SEARCH_H
+
+// index of the first occurrence of needle in haystack, -1 if there is none; an empty needle is found at 0
+int search_text(const char *haystack, int length, const char *needle, int needle_length);
+
+// occurrences of needle in haystack that do not overlap, length + 1 for an empty needle
+int count_text(const char *haystack, int length, const char *needle, int needle_length);
+
+#endif //FILANG_SEARCH_H
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "strings.h"
+#include "memory.h"
+#include "vm.h"
+
+#define SNAPSHOT_MAGIC "FIS"
+#define BYTE_ORDER_MARK 0x01020304u
+#define ALIGN(offset) (((offset) + 7) & ~(size_t) 7)
+
+/*
+ * The header is followed by the strings and then the globals. Each record holds the slot of its
+ * entry in the table it is restored into, strings in the globals are stored as their offset, short ones as
+ * they are.
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t value_size;
+    uint32_t byte_order;
+    uint32_t strings_count;
+    uint32_t strings_capacity;
+    uint32_t globals_count;
+    uint32_t globals_capacity;
+    uint64_t globals_offset;
+    uint64_t hash_seed;         // the slots and hashes were computed with it, a restoring VM takes it over
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t slot;
+    ObjString string;
+} StringRecord;
+
+typedef struct {
+    uint32_t slot;
+    uint32_t key;
+    Value value;
+} GlobalRecord;
+
+#define RECORD_HEADER offsetof(StringRecord, string.chars)
+
+static size_t record_size(int length) {
+    return ALIGN(RECORD_HEADER + (size_t) length + 1);
+}
+
+static void add_reachable(Hashmap *strings, Value value) {
+    if (IS_STRING(value)) add_entry(strings, value, NIL);
+}
+
+static uint64_t string_offset(Hashmap *offsets, Value value) {
+    return (uint64_t) get_entry(offsets, value)->value.as.integer;
+}
+
+static bool write_strings(FILE *file, const Hashmap *strings) {
+    static const char zeros[8] = {0};
+
+    for (int i = 0; i < strings->capacity; i++) {
+        if (IS_EMPTY(strings->entries[i])) continue;
+
+        ObjString *string = AS_STRING(strings->entries[i].key);
+        StringRecord record;
+        memset(&record, 0, sizeof(record));
+        record.slot = i;
+        record.string.object.type = OBJ_STRING;
+        record.string.object.external = true;
+        record.string.length = string->length;
+        record.string.hash = string->hash;
+
+        size_t padding = record_size(string->length) - RECORD_HEADER - (size_t) string->length;
+        if (fwrite(&record, 1, RECORD_HEADER, file) != RECORD_HEADER ||
+            fwrite(string->chars, 1, (size_t) string->length, file) != (size_t) string->length ||
+            fwrite(zeros, 1, padding, file) != padding) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool write_globals(FILE *file, Hashmap *offsets) {
+    for (int i = 0; i < vm.globals.capacity; i++) {
+        Entry *entry = &vm.globals.entries[i];
+        if (IS_EMPTY(*entry)) continue;
+
+        GlobalRecord record;
+        memset(&record, 0, sizeof(record));
+        record.slot = i;
+        record.key = string_offset(offsets, entry->key);
+        record.value.type = entry->value.type;
+        record.value.as = entry->value.as;
+        if (IS_STRING(entry->value)) record.value.as.object = (Object *) (uintptr_t) string_offset(offsets, entry->value);
+
+        if (fwrite(&record, sizeof(record), 1, file) != 1) return false;
+    }
+
+    return true;
+}
+
+bool write_snapshot(const char *path) {
+    // only the strings the globals refer to are kept, the rest of vm.strings is garbage by now
+    Hashmap strings;
+    init_hashmap(&strings);
+    for (int i = 0; i < vm.globals.capacity; i++) {
+        if (IS_EMPTY(vm.globals.entries[i])) continue;
+        if (IS_OBJECT(vm.globals.entries[i].value) && IS_TEXT(vm.globals.entries[i].value)) {
+            // a rope that cannot be flattened within the memory limit cannot be written either
+            ObjString *string = text_string(vm.globals.entries[i].value);
+            if (string == NULL) {
+                free_hashmap(&strings);
+                return false;
+            }
+            vm.globals.entries[i].value = STRING_CAST(intern_runtime_string(string));
+        }
+        add_reachable(&strings, vm.globals.entries[i].key);
+        add_reachable(&strings, vm.globals.entries[i].value);
+    }
+
+    // the strings are written in table order, each one remembers its offset in the value of its entry
+    size_t offset = sizeof(SnapshotHeader);
+    for (int i = 0; i < strings.capacity; i++) {
+        if (IS_EMPTY(strings.entries[i])) continue;
+        strings.entries[i].value = NEW_INTEGER(offset);
+        offset += record_size(AS_STRING(strings.entries[i].key)->length);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.value_size = sizeof(Value);
+    header.byte_order = BYTE_ORDER_MARK;
+    header.strings_count = strings.count;
+    header.strings_capacity = strings.capacity;
+    header.globals_count = vm.globals.count;
+    header.globals_capacity = vm.globals.capacity;
+    header.globals_offset = offset;
+    header.hash_seed = hash_seed;
+
+    char *temp_path = malloc(strlen(path) + 32);
+    sprintf(temp_path, "%s.%ld.tmp", path, (long) getpid());
+
+    // keys are stored in 32 bits
+    FILE *file = offset <= UINT32_MAX ? fopen(temp_path, "wb") : NULL;
+    bool written = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1 && write_strings(file, &strings) &&
+                   write_globals(file, &strings);
+
+    if (file != NULL && fclose(file) != 0) written = false;
+    if (written) written = rename(temp_path, path) == 0;
+    if (!written && file != NULL) unlink(temp_path);
+
+    free(temp_path);
+    free_hashmap(&strings);
+    return written;
+}
+
+static Entry *allocate_table(uint32_t capacity) {
+    if (capacity == 0) return NULL;
+
+    Entry *entries = ALLOCATE(Entry, capacity, MEMORY_ENTRIES);
+    for (uint32_t i = 0; i < capacity; i++) {
+        entries[i].key = NIL;
+        entries[i].value = NIL;
+    }
+    return entries;
+}
+
+static bool valid_table(uint32_t count, uint32_t capacity) {
+    return (capacity & (capacity - 1)) == 0 && capacity <= INT32_MAX && count <= capacity * HASHMAP_MAX_LOAD;
+}
+
+static ObjString *string_at(const Snapshot *snapshot, const SnapshotHeader *header, uint64_t offset) {
+    if (offset < sizeof(SnapshotHeader) || offset > header->globals_offset - RECORD_HEADER || offset % 8 != 0) {
+        return NULL;
+    }
+
+    StringRecord *record = (StringRecord *) (snapshot->mapping + offset);
+    if (record->string.object.type != OBJ_STRING || !record->string.object.external || record->string.length < 0 ||
+        (uint64_t) record->string.length >= header->globals_offset - offset - RECORD_HEADER) {
+        return NULL;
+    }
+
+    return &record->string;
+}
+
+// the entries go back into the slots they were written from, the strings hash the same as they did then
+static bool restore_strings(const Snapshot *snapshot, const SnapshotHeader *header, Hashmap *strings) {
+    init_hashmap(strings);
+    strings->entries = allocate_table(header->strings_capacity);
+    strings->capacity = (int) header->strings_capacity;
+
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (uint32_t i = 0; i < header->strings_count; i++) {
+        ObjString *string = string_at(snapshot, header, offset);
+        if (string == NULL) return false;
+
+        uint32_t slot = ((StringRecord *) (snapshot->mapping + offset))->slot;
+        if (slot >= header->strings_capacity || !IS_EMPTY(strings->entries[slot])) return false;
+
+        strings->entries[slot].key = STRING_CAST(string);
+        strings->count++;
+        offset += record_size(string->length);
+    }
+
+    return offset == header->globals_offset;
+}
+
+static bool restore_globals(const Snapshot *snapshot, const SnapshotHeader *header, Hashmap *globals) {
+    init_hashmap(globals);
+    if (header->globals_offset + sizeof(GlobalRecord) * (uint64_t) header->globals_count != snapshot->size) {
+        return false;
+    }
+
+    globals->entries = allocate_table(header->globals_capacity);
+    globals->capacity = (int) header->globals_capacity;
+
+    GlobalRecord *records = (GlobalRecord *) (snapshot->mapping + header->globals_offset);
+    for (uint32_t i = 0; i < header->globals_count; i++) {
+        GlobalRecord *record = &records[i];
+        ObjString *key = string_at(snapshot, header, record->key);
+        Value value = record->value;
+
+        if (key == NULL || record->slot >= header->globals_capacity || !IS_EMPTY(globals->entries[record->slot]) ||
+            value.type > TYPE_SHORT_STRING) {
+            return false;
+        }
+
+        if (IS_SHORT_STRING(value) && !VALID_SHORT_STRING(value)) return false;
+
+        if (IS_OBJECT(value)) {
+            ObjString *string = string_at(snapshot, header, (uintptr_t) value.as.object);
+            if (string == NULL) return false;
+            value = STRING_CAST(string);
+        }
+
+        globals->entries[record->slot].key = STRING_CAST(key);
+        globals->entries[record->slot].value = value;
+        globals->count++;
+    }
+
+    return true;
+}
+
+bool load_snapshot(const char *path, Snapshot *snapshot) {
+    snapshot->mapping = NULL;
+    if (vm.strings.count != 0) return false;
+
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) return false;
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || (size_t) info.st_size < sizeof(SnapshotHeader)) {
+        close(descriptor);
+        return false;
+    }
+
+    snapshot->size = (size_t) info.st_size;
+    snapshot->mapping = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (snapshot->mapping == MAP_FAILED) {
+        snapshot->mapping = NULL;
+        return false;
+    }
+
+    SnapshotHeader *header = (SnapshotHeader *) snapshot->mapping;
+    bool valid = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                 header->version == SNAPSHOT_VERSION && header->value_size == sizeof(Value) &&
+                 header->byte_order == BYTE_ORDER_MARK && header->globals_offset >= sizeof(SnapshotHeader) &&
+                 header->globals_offset <= snapshot->size && header->globals_offset % 8 == 0 &&
+                 valid_table(header->strings_count, header->strings_capacity) &&
+                 valid_table(header->globals_count, header->globals_capacity);
+
+    Hashmap strings;
+    Hashmap globals;
+    init_hashmap(&strings);
+    init_hashmap(&globals);
+
+    // nothing has been hashed yet, the tables are laid out for this seed and it is taken over with them
+    if (valid) set_hash_seed(header->hash_seed);
+
+    if (!valid || !restore_strings(snapshot, header, &strings) || !restore_globals(snapshot, header, &globals)) {
+        free_hashmap(&strings);
+        free_hashmap(&globals);
+        unload_snapshot(snapshot);
+        return false;
+    }
+
+    free_hashmap(&vm.strings);
+    free_hashmap(&vm.globals);
+    vm.strings = strings;
+    vm.globals = globals;
+    return true;
+}
+
+void unload_snapshot(Snapshot *snapshot) {
+    munmap(snapshot->mapping, snapshot->size);
+    snapshot->mapping = NULL;
+    snapshot->size = 0;
+}
@@ -0,0 +1,33 @@
+#ifndef FILANG_SNAPSHOT_H
+#define FILANG_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * .fis files hold the globals of a VM and the strings they refer to, so that a prelude run once
+ * can be restored by later processes. The strings are used in place from a read-only mapping,
+ * only the tables that index them are rebuilt, each entry going back into the slot it was written from.
+ */
+#define SNAPSHOT_VERSION 4
+
+typedef struct {
+    uint8_t *mapping;
+    size_t size;
+} Snapshot;
+
+// writes vm.globals and the strings reachable from them, returns false if the file could not be written
+bool write_snapshot(const char *path);
+
+/*
+ * Restores the globals and strings of a snapshot into a VM that has not interned any string yet, which takes
+ * over the hash seed of the VM that wrote it. The snapshot must stay loaded for as long as the VM uses its strings.
+ * Its tables are restored slot for slot, so the seed comes with them; a snapshot is only ever restored when asked
+ * for with --restore and is trusted like the script, bytecode files are hashed again instead.
+ */
+bool load_snapshot(const char *path, Snapshot *snapshot);
+
+void unload_snapshot(Snapshot *snapshot);
+
+#endif //FILANG_SNAPSHOT_H
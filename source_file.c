@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source_file.h"
+
+#define STREAM_RESERVE ((size_t) 1 << 36)
+#define STREAM_READ ((size_t) 1 << 16)
+
+bool map_source_file(const char *path, SourceFile *file) {
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) return false;
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(descriptor);
+        return false;
+    }
+
+    file->length = (size_t) info.st_size;
+    file->chars = "";
+
+    // an empty file cannot be mapped, and has nothing to map anyway
+    if (file->length > 0) {
+        void *mapping = mmap(NULL, file->length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            close(descriptor);
+            return false;
+        }
+
+        madvise(mapping, file->length, MADV_SEQUENTIAL);
+        file->chars = mapping;
+    }
+
+    close(descriptor);
+    return true;
+}
+
+// drops the whole pages of chars that lie before up_to
+static void release_pages(const char *chars, size_t length, const char *up_to) {
+    if (up_to < chars || up_to > chars + length) return;
+
+    uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) chars + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = (uintptr_t) up_to & ~(page_size - 1);
+
+    if (end > start) {
+        madvise((void *) start, end - start, MADV_DONTNEED);
+    }
+}
+
+void release_source_file(const SourceFile *file, const char *up_to) {
+    if (file->length > 0) release_pages(file->chars, file->length, up_to);
+}
+
+void unmap_source_file(SourceFile *file) {
+    if (file->length > 0) {
+        munmap((void *) file->chars, file->length);
+    }
+
+    file->chars = NULL;
+    file->length = 0;
+}
+
+bool open_source_stream(int descriptor, SourceStream *stream) {
+    stream->descriptor = descriptor;
+    stream->length = 0;
+    stream->finished = false;
+
+    // only the pages that are written to take memory, so reserve as much address space as is granted
+    for (stream->capacity = STREAM_RESERVE; stream->capacity >= STREAM_READ; stream->capacity /= 2) {
+        void *region = mmap(NULL, stream->capacity, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region != MAP_FAILED) {
+            stream->chars = region;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool read_more(SourceStream *stream) {
+    while (!stream->finished) {
+        size_t room = stream->capacity - stream->length;
+        ssize_t bytes_read = read(stream->descriptor, stream->chars + stream->length, room < STREAM_READ ? room : STREAM_READ);
+
+        if (bytes_read > 0) {
+            stream->length += (size_t) bytes_read;
+            return true;
+        }
+
+        if (bytes_read < 0 && errno == EINTR) continue;
+
+        if (room == 0) fprintf(stderr, "Input too large, ignoring the rest of it.\n");
+        stream->finished = true;
+    }
+
+    return false;
+}
+
+void release_source_stream(const SourceStream *stream, const char *up_to) {
+    release_pages(stream->chars, stream->length, up_to);
+}
+
+void close_source_stream(SourceStream *stream) {
+    munmap(stream->chars, stream->capacity);
+    stream->chars = NULL;
+    stream->length = 0;
+    stream->capacity = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef FILANG_SOURCE_FILE_H
+#define FILANG_SOURCE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A script mapped read-only into memory. The characters are not NUL terminated.
+ */
+typedef struct {
+    const char *chars;
+    size_t length;
+} SourceFile;
+
+bool map_source_file(const char *path, SourceFile *file);
+
+// drops the pages before up_to from memory, they are read from the file again if touched
+void release_source_file(const SourceFile *file, const char *up_to);
+
+void unmap_source_file(SourceFile *file);
+
+/*
+ * A script read a piece at a time, from a pipe for instance. New input is appended to a large
+ * reserved region, so the characters never move and tokens scanned earlier stay valid.
+ */
+typedef struct {
+    int descriptor;
+    char *chars;
+    size_t length;
+    size_t capacity;    // bytes reserved for chars
+    bool finished;      // the end of the input has been reached
+} SourceStream;
+
+bool open_source_stream(int descriptor, SourceStream *stream);
+
+// blocks until more input arrives, returns false at the end of it
+bool read_more(SourceStream *stream);
+
+void release_source_stream(const SourceStream *stream, const char *up_to);
+
+void close_source_stream(SourceStream *stream);
+
+#endif //FILANG_SOURCE_FILE_H
@@ -0,0 +1,82 @@
+#include <time.h>
+#include "stats.h"
+#include "scanner.h"
+#include "disassembler.h"
+
+double now_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+void init_compile_stats(CompileStats *stats) {
+    stats->source_bytes = 0;
+    stats->tokens = 0;
+    stats->read_time = 0;
+    stats->scan_time = 0;
+    stats->parse_time = 0;
+    stats->intern_time = 0;
+    stats->relax_time = 0;
+}
+
+long count_tokens(const char *source, size_t length) {
+    Scanner scanner;
+    init_scanner(&scanner, source, length);
+
+    long tokens = 0;
+    while (scan_token(&scanner).type != TOKEN_EOF) {
+        tokens++;
+    }
+
+    return tokens;
+}
+
+static double per_second(double amount, double seconds) {
+    return seconds > 0 ? amount / seconds : 0;
+}
+
+void print_compile_stats(FILE *out, const CompileStats *stats, Chunk *chunk, Hashmap *strings) {
+    long opcodes[UINT8_MAX + 1] = {0};
+
+    for (int i = 0; i < chunk->count; i += instruction_length(chunk->code[i])) {
+        opcodes[chunk->code[i]]++;
+    }
+
+    double compile_time = stats->parse_time + stats->intern_time + stats->relax_time;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"phases\": {\"read_ms\": %.3f, \"scan_ms\": %.3f, \"parse_ms\": %.3f, \"intern_ms\": %.3f, "
+                 "\"relax_ms\": %.3f, \"compile_ms\": %.3f},\n",
+            stats->read_time * 1e3, stats->scan_time * 1e3, stats->parse_time * 1e3, stats->intern_time * 1e3,
+            stats->relax_time * 1e3, compile_time * 1e3);
+    fprintf(out, "  \"source_bytes\": %zu,\n", stats->source_bytes);
+    fprintf(out, "  \"tokens\": %ld,\n", stats->tokens);
+    fprintf(out, "  \"tokens_per_second\": %.0f,\n", per_second((double) stats->tokens, stats->scan_time));
+    fprintf(out, "  \"scan_mb_per_second\": %.1f,\n", per_second((double) stats->source_bytes / 1e6, stats->scan_time));
+    fprintf(out, "  \"code_bytes\": %d,\n", chunk->count);
+    fprintf(out, "  \"constants\": %d,\n", chunk->constants.count);
+    fprintf(out, "  \"constant_operands\": {\"1_byte\": %ld, \"2_bytes\": %ld, \"3_bytes\": %ld},\n",
+            opcodes[OP_CONSTANT], opcodes[OP_CONSTANT_LONG], opcodes[OP_CONSTANT_LONG_LONG]);
+    fprintf(out, "  \"jump_operands\": {\"1_byte\": %ld, \"2_bytes\": %ld, \"4_bytes\": %ld},\n",
+            opcodes[OP_JUMP_SHORT] + opcodes[OP_JUMP_IF_FALSE_SHORT], opcodes[OP_JUMP] + opcodes[OP_JUMP_IF_FALSE],
+            opcodes[OP_JUMP_WIDE] + opcodes[OP_JUMP_IF_FALSE_WIDE]);
+    fprintf(out, "  \"line_table\": {\"records\": %d, \"bytes\": %zu},\n", chunk->lines.records,
+            (size_t) chunk->lines.count + sizeof(LineCheckpoint) * (size_t) chunk->lines.checkpoint_count);
+    fprintf(out, "  \"interned_strings\": %d,\n", strings->count);
+    fprintf(out, "  \"opcodes\": {");
+
+    bool first = true;
+    for (int opcode = 0; opcode <= UINT8_MAX; opcode++) {
+        if (opcodes[opcode] == 0) continue;
+
+        const char *name = opcode_name(opcode);
+        if (name != NULL) {
+            fprintf(out, "%s\"%s\": %ld", first ? "" : ", ", name, opcodes[opcode]);
+        } else {
+            fprintf(out, "%s\"%d\": %ld", first ? "" : ", ", opcode, opcodes[opcode]);
+        }
+        first = false;
+    }
+
+    fprintf(out, "}\n}\n");
+}
@@ -0,0 +1,29 @@
+#ifndef FILANG_STATS_H
+#define FILANG_STATS_H
+
+#include <stdio.h>
+#include "chunk.h"
+#include "hashmap.h"
+
+/*
+ * Timings of a single compilation, in seconds, filled in by compile_with_stats() and the caller.
+ */
+typedef struct {
+    size_t source_bytes;
+    long tokens;
+    double read_time;
+    double scan_time;
+    double parse_time;
+    double intern_time;
+    double relax_time;
+} CompileStats;
+
+double now_seconds();
+
+void init_compile_stats(CompileStats *stats);
+
+long count_tokens(const char *source, size_t length);
+
+void print_compile_stats(FILE *out, const CompileStats *stats, Chunk *chunk, Hashmap *strings);
+
+#endif //FILANG_STATS_H
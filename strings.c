@@ -5,7 +5,10 @@
 #include "memory.h"
 #include "hashmap.h"
 #include "vm.h"
+#include "number_format.h"
+#include "search.h"
 #include <string.h>
+#include <limits.h>
 #include <malloc.h>
 
 char *type_to_string(Value value) {
@@ -18,8 +21,10 @@ char *type_to_string(Value value) {
             return "<builtin 'integer'>";
         case TYPE_NIL:
             return "<builtin 'nil'>";
+        case TYPE_SHORT_STRING:
+            return "<class 'String'>";
         case TYPE_OBJECT:
-            if (IS_STRING(value))
+            if (IS_TEXT(value))
                 return "<class 'String'>";
             else
                 return "<class 'Object'>";
@@ -28,65 +33,479 @@ char *type_to_string(Value value) {
     }
 }
 
-static char *long_to_string(int64_t value) {
-    char *buffer = ALLOCATE(char, 22);
-    snprintf(buffer, 22, "%ld", value);
-    return buffer;
-}
-
-static char *double_to_string(double value) {
-    char *buffer = ALLOCATE(char, 22);
-    snprintf(buffer, 22, "%.15g", value);
-    return buffer;
-}
-
-ObjString *value_to_string(Value value) {
-    char *value_as_string;
+/*
+ * Returns the textual form of value, numbers and short strings are formatted into buffer
+ * (at least NUMBER_BUFFER bytes), everything else points to existing characters.
+ */
+static int value_chars(Value value, char *buffer, const char **chars) {
     switch (value.type) {
         case TYPE_INTEGER:
-            value_as_string = long_to_string(value.as.integer);
-            return make_objstring(value_as_string, (int) strlen(value_as_string));
+            *chars = buffer;
+            return format_integer(value.as.integer, buffer);
         case TYPE_DECIMAL:
-            value_as_string = double_to_string(value.as.decimal);
-            return make_objstring(value_as_string, (int) strlen(value_as_string));
+            *chars = buffer;
+            return format_decimal(value.as.decimal, buffer);
         case TYPE_BOOL:
-            if (value.as.integer == 0) {
-                return make_objstring("false", 6);
-            } else {
-                return make_objstring("true", 5);
-            }
+            *chars = value.as.integer == 0 ? "false" : "true";
+            return value.as.integer == 0 ? 5 : 4;
+        case TYPE_SHORT_STRING:
+            *chars = memcpy(buffer, value.as.chars, sizeof(value.as.chars));
+            return SHORT_STRING_LENGTH(value);
         case TYPE_OBJECT:
-            if (IS_STRING(value))
-                return ((ObjString *) value.as.object);
-            else
-                return make_objstring(type_to_string(value), (int) strlen(type_to_string(value)));
+            if (IS_TEXT(value)) {
+                *chars = text_chars(&value);
+                return TEXT_LENGTH(value);
+            }
+            *chars = type_to_string(value);
+            return (int) strlen(*chars);
         case TYPE_NIL:
         default:
-            return make_objstring("nil", 4);
+            *chars = "nil";
+            return 3;
     }
 }
 
+static ObjString *init_string(ObjString *string, int length) {
+    string->object.type = OBJ_STRING;
+    string->object.marked = false;
+    string->object.external = false;
+    string->object.interned = false;
+    string->object.next = NULL;
+    string->length = length;
+    string->chars[length] = '\0';
+    return string;
+}
+
+ObjString *allocate_string(int length) {
+    return init_string(allocate_object(STRING_SIZE(length)), length);
+}
+
+static ObjString *track_string(ObjString *string) {
+    string->hash = 0;
+    track_object((Object *) string, STRING_SIZE(string->length));
+    return string;
+}
+
+// strings in vm.strings belong to the collector, those in a compiler's own table are freed with it
+static void add_string(Hashmap *strings, ObjString *string) {
+    add_entry(strings, STRING_CAST(string), NIL);
+    string->object.interned = true;
+    if (strings == &vm.strings) track_object((Object *) string, STRING_SIZE(string->length));
+}
+
+ObjString *intern_string(ObjString *string) {
+    string->hash = hash_string(string->chars, string->length);
+    ObjString *interned = get_string_entry(&vm.strings, string->chars, string->length, string->hash);
+    if (interned != NULL) {
+        free_object_memory(string, STRING_SIZE(string->length));
+        return interned;
+    }
+
+    add_string(&vm.strings, string);
+    return string;
+}
+
+// strings made at runtime are hashed the first time they are looked up, 0 stands for not hashed yet
+uint32_t string_hash(ObjString *string) {
+    if (string->hash == 0 && !IS_INTERNED(string)) string->hash = hash_string(string->chars, string->length);
+    return string->hash;
+}
+
+// a string made at runtime already belongs to the collector, a copy of it interned before is left to it
+ObjString *intern_runtime_string(ObjString *string) {
+    if (IS_INTERNED(string)) return string;
+
+    ObjString *interned = get_string_entry(&vm.strings, string->chars, string->length, string_hash(string));
+    if (interned != NULL) return interned;
+
+    add_entry(&vm.strings, STRING_CAST(string), NIL);
+    string->object.interned = true;
+    return string;
+}
+
+ObjString *intern_external_string(ObjString *string) {
+    ObjString *interned = get_string_entry(&vm.strings, string->chars, string->length, string->hash);
+    if (interned != NULL) return interned;
+
+    add_entry(&vm.strings, STRING_CAST(string), NIL);
+    return string;
+}
+
+Value make_short_string(const char *chars, int length) {
+    Value value = {TYPE_SHORT_STRING, {.integer = 0}};
+    memcpy(value.as.chars, chars, length);
+    value.as.chars[SHORT_STRING_MAX] = (char) (SHORT_STRING_MAX - length);
+    return value;
+}
+
 ObjString *make_objstring(const char *chars, int length) {
+    return make_objstring_in(&vm.strings, chars, length);
+}
+
+ObjString *make_objstring_in(Hashmap *strings, const char *chars, int length) {
     uint32_t hash = hash_string(chars, length);
-    ObjString *interned = get_string_entry(&vm.strings, chars, length, hash);
+    ObjString *interned = get_string_entry(strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    ObjString *string = malloc(sizeof(ObjString) + sizeof(char) * (length + 1));
-    string->type = OBJ_STRING;
-    string->length = length;
+    // the slabs belong to the VM, compilers running on threads of their own allocate with malloc
+    ObjString *string;
+    if (strings == &vm.strings) {
+        string = allocate_string(length);
+    } else {
+        string = init_string(malloc(STRING_SIZE(length)), length);
+        account_memory(MEMORY_STRINGS, 0, STRING_SIZE(length));
+    }
     memcpy(string->chars, chars, length);
-    string->chars[length] = '\0';
     string->hash = hash;
 
-    add_entry(&vm.strings, STRING_CAST(string), NIL);
+    add_string(strings, string);
     return string;
 }
 
 ObjString *concatenate_strings(ObjString *a, ObjString *b) {
-    int length = a->length + b->length;
-    char *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    return make_objstring(chars, length);
+    ObjString *string = allocate_string(a->length + b->length);
+    memcpy(string->chars, a->chars, a->length);
+    memcpy(string->chars + a->length, b->chars, b->length);
+    return intern_string(string);
+}
+
+/*
+ * Builds the concatenation of up to UINT8_MAX values in a single buffer,
+ * converting the non string values on the fly. The result is neither hashed nor interned,
+ * and is a short string if it fits in one unless it is to be a piece of a rope.
+ * Returns nil, allocating nothing, if the result would not fit in the memory limit.
+ */
+static Value join_values(const Value *values, int count, bool piece) {
+    char numbers[UINT8_MAX][NUMBER_BUFFER];
+    const char *parts[UINT8_MAX];
+    int lengths[UINT8_MAX];
+    size_t length = 0;
+
+    for (int i = 0; i < count; i++) {
+        lengths[i] = value_chars(values[i], numbers[i], &parts[i]);
+        length += lengths[i];
+    }
+
+    char short_chars[SHORT_STRING_MAX];
+    bool is_short = length <= SHORT_STRING_MAX && !piece;
+    if (!is_short && (length > INT_MAX || !within_budget(STRING_SIZE(length)))) return NIL;
+
+    ObjString *string = is_short ? NULL : allocate_string((int) length);
+    char *end = is_short ? short_chars : string->chars;
+    for (int i = 0; i < count; i++) {
+        memcpy(end, parts[i], lengths[i]);
+        end += lengths[i];
+    }
+
+    return is_short ? make_short_string(short_chars, (int) length) : NEW_OBJECT(track_string(string));
+}
+
+static bool is_long(Value value) {
+    return IS_ROPE(value) || ((IS_STRING(value) || IS_VIEW(value)) && TEXT_LENGTH(value) >= ROPE_MIN_LENGTH);
+}
+
+static ObjRope *new_rope(Object *left, Object *right) {
+    Value left_value = NEW_OBJECT(left), right_value = NEW_OBJECT(right);
+    size_t length = (size_t) TEXT_LENGTH(left_value) + (size_t) TEXT_LENGTH(right_value);
+    if (length > INT_MAX) return NULL;
+
+    int left_depth = IS_ROPE(left_value) ? AS_ROPE(left_value)->depth : 0;
+    int right_depth = IS_ROPE(right_value) ? AS_ROPE(right_value)->depth : 0;
+
+    ObjRope *rope = allocate_object(sizeof(ObjRope));
+    rope->object.type = OBJ_ROPE;
+    rope->object.marked = false;
+    rope->object.external = false;
+    rope->object.interned = false;
+    rope->length = (int) length;
+    rope->depth = (left_depth > right_depth ? left_depth : right_depth) + 1;
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    track_object((Object *) rope, sizeof(ObjRope));
+    return rope;
+}
+
+static bool is_short_string(const Object *object) {
+    return object != NULL && object->type == OBJ_STRING && ((const ObjString *) object)->length < ROPE_MIN_LENGTH;
+}
+
+static ObjString *join_pieces(Object *left, Object *right) {
+    Value pieces[2] = {NEW_OBJECT(left), NEW_OBJECT(right)};
+    Value joined = join_values(pieces, 2, true);
+    return IS_NIL(joined) ? NULL : AS_STRING(joined);
+}
+
+/*
+ * A short string added next to the short string at the end of a rope is joined with it, so that each
+ * piece of a rope built by appending a little at a time holds up to ROPE_MIN_LENGTH characters.
+ */
+static ObjRope *make_rope(Object *left, Object *right) {
+    if (left->type == OBJ_ROPE && is_short_string(right) && is_short_string(((ObjRope *) left)->right) &&
+        ((ObjString *) ((ObjRope *) left)->right)->length + ((ObjString *) right)->length < ROPE_MIN_LENGTH) {
+        ObjString *joined = join_pieces(((ObjRope *) left)->right, right);
+        return joined == NULL ? NULL : new_rope(((ObjRope *) left)->left, (Object *) joined);
+    }
+
+    if (right->type == OBJ_ROPE && is_short_string(left) && is_short_string(((ObjRope *) right)->left) &&
+        ((ObjString *) left)->length + ((ObjString *) ((ObjRope *) right)->left)->length < ROPE_MIN_LENGTH) {
+        ObjString *joined = join_pieces(left, ((ObjRope *) right)->left);
+        return joined == NULL ? NULL : new_rope((Object *) joined, ((ObjRope *) right)->right);
+    }
+
+    return new_rope(left, right);
+}
+
+/*
+ * Long operands become pieces of a rope as they are, the runs of short ones between them are joined
+ * into a string each, so building a string by appending to it costs what is appended every time.
+ */
+Value concatenate_values(const Value *values, int count) {
+    bool keeps_pieces = false;
+    for (int i = 0; i < count && !keeps_pieces; i++) {
+        keeps_pieces = is_long(values[i]);
+    }
+
+    if (!keeps_pieces) return join_values(values, count, false);
+    if (!within_budget(sizeof(ObjRope) * count)) return NIL;
+
+    Object *result = NULL;
+    for (int i = 0; i < count;) {
+        Object *piece;
+        if (is_long(values[i]) || (IS_STRING(values[i]) && (i + 1 == count || is_long(values[i + 1])))) {
+            piece = AS_OBJECT(values[i++]);
+        } else {
+            int run = i;
+            while (run < count && !is_long(values[run])) run++;
+            Value joined = join_values(values + i, run - i, true);
+            piece = IS_NIL(joined) ? NULL : AS_OBJECT(joined);
+            i = run;
+        }
+
+        if (piece == NULL) return NIL;
+        result = result == NULL ? piece : (Object *) make_rope(result, piece);
+        if (result == NULL) return NIL;
+    }
+
+    return NEW_OBJECT(result);
+}
+
+// a rope or a view from before the arena was installed must not be left pointing into it
+static bool may_refer_to_arena(const Object *object) {
+    return vm.arena == NULL || !vm.arena->active || in_arena(vm.arena, object);
+}
+
+#define FLATTEN_STACK 64
+
+// the pieces are copied from the last one back, the ones left of the current piece wait on a stack
+static ObjString *build_flat_string(ObjRope *rope) {
+    if (rope->flat != NULL) return rope->flat;
+
+    Object *local[FLATTEN_STACK];
+    Object **stack = rope->depth < FLATTEN_STACK ? local : ALLOCATE(Object *, rope->depth + 1, MEMORY_TEMPORARY);
+    int count = 0;
+    stack[count++] = (Object *) rope;
+
+    ObjString *string = allocate_string(rope->length);
+    char *end = string->chars + rope->length;
+
+    while (count > 0) {
+        Object *piece = stack[--count];
+        if (piece->type == OBJ_ROPE && ((ObjRope *) piece)->flat == NULL) {
+            stack[count++] = ((ObjRope *) piece)->left;
+            stack[count++] = ((ObjRope *) piece)->right;
+            continue;
+        }
+
+        Value leaf = NEW_OBJECT(piece);
+        end -= TEXT_LENGTH(leaf);
+        memcpy(end, text_chars(&leaf), TEXT_LENGTH(leaf));
+    }
+
+    if (stack != local) FREE_ARRAY(stack, Object *, rope->depth + 1, MEMORY_TEMPORARY);
+    track_string(string);
+
+    if (may_refer_to_arena((Object *) rope)) {
+        rope->flat = string;
+        rope->left = NULL;
+        rope->right = NULL;
+    }
+
+    return string;
+}
+
+ObjString *flatten_rope(ObjRope *rope) {
+    if (rope->flat == NULL && !within_budget(STRING_SIZE(rope->length))) return NULL;
+    return build_flat_string(rope);
+}
+
+Value slice_text(Value text, int start, int length) {
+    if (IS_ROPE(text)) {
+        ObjString *flat = flatten_rope(AS_ROPE(text));
+        if (flat == NULL) return NIL;
+        text = NEW_OBJECT(flat);
+    }
+
+    if (length <= SHORT_STRING_MAX) return make_short_string(text_chars(&text) + start, length);
+    if (length == TEXT_LENGTH(text)) return text;
+    if (!within_budget(sizeof(ObjView))) return NIL;
+
+    // views are never of views, the flattened string of a rope is the parent
+    ObjString *parent;
+    if (IS_VIEW(text)) {
+        start += AS_VIEW(text)->offset;
+        parent = AS_VIEW(text)->parent;
+    } else {
+        parent = AS_STRING(text);
+    }
+
+    ObjView *view = allocate_object(sizeof(ObjView));
+    view->object.type = OBJ_VIEW;
+    view->object.marked = false;
+    view->object.external = false;
+    view->object.interned = false;
+    view->length = length;
+    view->offset = start;
+    view->parent = parent;
+    track_object((Object *) view, sizeof(ObjView));
+    return NEW_OBJECT(view);
+}
+
+static ObjString *copy_view_string(ObjView *view) {
+    if (view->offset == 0 && view->length == view->parent->length) return view->parent;
+
+    ObjString *string = allocate_string(view->length);
+    memcpy(string->chars, view->parent->chars + view->offset, view->length);
+    track_string(string);
+
+    // the characters it was sliced from are let go of
+    if (may_refer_to_arena((Object *) view)) {
+        view->parent = string;
+        view->offset = 0;
+    }
+
+    return string;
+}
+
+ObjString *view_string(ObjView *view) {
+    bool whole = view->offset == 0 && view->length == view->parent->length;
+    if (!whole && !within_budget(STRING_SIZE(view->length))) return NULL;
+    return copy_view_string(view);
+}
+
+ObjString *text_string(Value value) {
+    if (IS_ROPE(value)) return flatten_rope(AS_ROPE(value));
+    if (IS_VIEW(value)) return view_string(AS_VIEW(value));
+    return AS_STRING(value);
+}
+
+ObjString *text_string_unchecked(Value value) {
+    if (IS_ROPE(value)) return build_flat_string(AS_ROPE(value));
+    if (IS_VIEW(value)) return copy_view_string(AS_VIEW(value));
+    return AS_STRING(value);
+}
+
+const char *text_chars(const Value *value) {
+    if (IS_SHORT_STRING(*value)) return value->as.chars;
+    if (IS_VIEW(*value)) return AS_VIEW(*value)->parent->chars + AS_VIEW(*value)->offset;
+
+    ObjString *string = text_string(*value);
+    return string == NULL ? NULL : string->chars;
+}
+
+// interned strings are equal only if they are the same string, the others are compared by their characters
+bool texts_equal(Value a, Value b) {
+    if (IS_SHORT_STRING(a) || IS_SHORT_STRING(b)) return a.type == b.type && a.as.integer == b.as.integer;
+    if (TEXT_LENGTH(a) != TEXT_LENGTH(b)) return false;
+
+    if (IS_ROPE(a)) a = NEW_OBJECT(build_flat_string(AS_ROPE(a)));
+    if (IS_ROPE(b)) b = NEW_OBJECT(build_flat_string(AS_ROPE(b)));
+    if (AS_OBJECT(a) == AS_OBJECT(b)) return true;
+    if (IS_STRING(a) && IS_STRING(b) && IS_INTERNED(AS_STRING(a)) && IS_INTERNED(AS_STRING(b))) return false;
+    return memcmp(text_chars(&a), text_chars(&b), TEXT_LENGTH(a)) == 0;
+}
+
+const MethodSignature string_methods[STRING_METHODS] = {
+        [METHOD_FIND]        = {"find", 1},
+        [METHOD_COUNT]       = {"count", 1},
+        [METHOD_CONTAINS]    = {"contains", 1},
+        [METHOD_STARTS_WITH] = {"starts_with", 1},
+        [METHOD_SPLIT]       = {"split", 2},
+        [METHOD_REPLACE]     = {"replace", 2},
+};
+
+int find_string_method(const char *name, int length) {
+    for (int i = 0; i < STRING_METHODS; i++) {
+        if ((int) strlen(string_methods[i].name) == length && memcmp(string_methods[i].name, name, length) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// the characters between the occurrences are copied as they are found, into a string counted out beforehand
+Value replace_text(Value text, Value old, Value replacement) {
+    const char *chars = text_chars(&text);
+    const char *old_chars = text_chars(&old);
+    const char *new_chars = text_chars(&replacement);
+    int length = TEXT_LENGTH(text), old_length = TEXT_LENGTH(old), new_length = TEXT_LENGTH(replacement);
+
+    int occurrences = count_text(chars, length, old_chars, old_length);
+    if (occurrences == 0) return text;
+
+    int64_t result_length = length + (int64_t) occurrences * (new_length - old_length);
+    char short_chars[SHORT_STRING_MAX];
+    bool is_short = result_length <= SHORT_STRING_MAX;
+    if (!is_short && (result_length > INT_MAX || !within_budget(STRING_SIZE(result_length)))) return NIL;
+
+    ObjString *string = is_short ? NULL : allocate_string((int) result_length);
+    char *end = is_short ? short_chars : string->chars;
+    for (int start = 0;;) {
+        int found = search_text(chars + start, length - start, old_chars, old_length);
+        if (found < 0) {
+            memcpy(end, chars + start, length - start);
+            break;
+        }
+
+        memcpy(end, chars + start, found);
+        memcpy(end + found, new_chars, new_length);
+        end += found + new_length;
+        start += found + old_length;
+    }
+
+    return is_short ? make_short_string(short_chars, (int) result_length) : NEW_OBJECT(track_string(string));
+}
+
+bool split_bounds(Value text, Value separator, int64_t index, int *start, int *length) {
+    const char *chars = text_chars(&text);
+    const char *separator_chars = text_chars(&separator);
+    int text_length = TEXT_LENGTH(text), separator_length = TEXT_LENGTH(separator);
+
+    if (index < 0) index += count_text(chars, text_length, separator_chars, separator_length) + 1;
+    if (index < 0) return false;
+
+    int piece = 0;
+    for (; index > 0; index--) {
+        int found = search_text(chars + piece, text_length - piece, separator_chars, separator_length);
+        if (found < 0) return false;
+        piece += found + separator_length;
+    }
+
+    int found = search_text(chars + piece, text_length - piece, separator_chars, separator_length);
+    *start = piece;
+    *length = found < 0 ? text_length - piece : found;
+    return true;
+}
+
+void free_strings(Hashmap *strings) {
+    for (int i = 0; i < strings->capacity; i++) {
+        if (!IS_EMPTY(strings->entries[i])) {
+            ObjString *string = AS_STRING(strings->entries[i].key);
+            account_memory(MEMORY_STRINGS, STRING_SIZE(string->length), 0);
+            free(string);
+        }
+    }
+
+    free_hashmap(strings);
 }
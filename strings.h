@@ -6,20 +6,147 @@
 #define IS_STRING(value) (IS_OBJECT(value) && ((Object *) (value).as.object)->type == OBJ_STRING)
 #define AS_STRING(value) ((ObjString *) AS_OBJECT(value))
 #define STRING_CAST(value) ((Value){TYPE_OBJECT, {.object = (Object *) (value)}})
+#define STRING_SIZE(length) (sizeof(ObjString) + sizeof(char) * ((length) + 1))
+#define IS_ROPE(value) (IS_OBJECT(value) && ((Object *) (value).as.object)->type == OBJ_ROPE)
+#define AS_ROPE(value) ((ObjRope *) AS_OBJECT(value))
+#define IS_VIEW(value) (IS_OBJECT(value) && ((Object *) (value).as.object)->type == OBJ_VIEW)
+#define AS_VIEW(value) ((ObjView *) AS_OBJECT(value))
+/*
+ * Strings of up to SHORT_STRING_MAX characters are held in the value itself, never in an ObjString, so two
+ * of them are equal only if their bits are. The last byte holds the room left, it ends a full one.
+ */
+#define SHORT_STRING_MAX 7
+#define IS_SHORT_STRING(value) ((value).type == TYPE_SHORT_STRING)
+#define SHORT_STRING_LENGTH(value) (SHORT_STRING_MAX - (value).as.chars[SHORT_STRING_MAX])
+// for short strings read back from a file
+#define VALID_SHORT_STRING(value) ((unsigned char) (value).as.chars[SHORT_STRING_MAX] <= SHORT_STRING_MAX)
+// a String to the scripts, whether its characters are in the value, in one piece, in several or in another string
+#define IS_TEXT(value) (IS_SHORT_STRING(value) || IS_STRING(value) || IS_ROPE(value) || IS_VIEW(value))
+// in vm.strings, where no other string has the same characters
+#define IS_INTERNED(string) ((string)->object.interned || (string)->object.external)
+#define TEXT_LENGTH(value) (IS_SHORT_STRING(value) ? SHORT_STRING_LENGTH(value) : \
+                           IS_STRING(value) ? AS_STRING(value)->length :   \
+                           IS_ROPE(value) ? AS_ROPE(value)->length : AS_VIEW(value)->length)
+
+// concatenations at least this long keep their long operands as they are instead of copying them
+#define ROPE_MIN_LENGTH 128
 
 typedef struct {
-    Objtype type;
+    Object object;
     int length;
     uint32_t hash;
     char chars[];
 } ObjString;
 
+/*
+ * A concatenation whose characters are only copied into one string the first time they are needed.
+ * The pieces are strings or ropes, and are let go of once it has been flattened.
+ */
+typedef struct {
+    Object object;
+    int length;
+    int depth;          // of the deepest piece below, strings count as 0
+    Object *left;
+    Object *right;
+    ObjString *flat;    // NULL until flattened
+} ObjRope;
+
+/*
+ * The characters of a string from offset on, sliced out of it without copying them. They are copied into
+ * a string of their own only once the view is hashed or stored in a global, which becomes its parent.
+ */
+typedef struct {
+    Object object;
+    int length;         // longer than SHORT_STRING_MAX, and shorter than its parent
+    int offset;
+    ObjString *parent;
+} ObjView;
+
 char *type_to_string(Value value);
 
-ObjString *value_to_string(Value value);
+typedef struct Hashmap Hashmap;
+
+Value make_short_string(const char *chars, int length);
 
 ObjString *make_objstring(const char *chars, int length);
 
+ObjString *make_objstring_in(Hashmap *strings, const char *chars, int length);
+
+// allocated from the VM's slabs, the string must end up interned in vm.strings or tracked by the collector
+ObjString *allocate_string(int length);
+
+ObjString *intern_string(ObjString *string);
+
+uint32_t string_hash(ObjString *string);
+
+// the interned string with the characters of a string made at runtime, the string itself if there is none yet
+ObjString *intern_runtime_string(ObjString *string);
+
+// interns a string the VM does not own, such as one in a mapped bytecode file, without copying it
+ObjString *intern_external_string(ObjString *string);
+
 ObjString *concatenate_strings(ObjString *a, ObjString *b);
 
+/*
+ * A short string, a string not interned yet, or a rope when the result is long and some operand already is,
+ * nil if it would not fit in the memory limit.
+ */
+Value concatenate_values(const Value *values, int count);
+
+// the rope as one string, kept for later, NULL, allocating nothing, if it would not fit in the memory limit
+ObjString *flatten_rope(ObjRope *rope);
+
+// length characters of a String value from start, both within it, nil if a view would not fit in the memory limit
+Value slice_text(Value text, int start, int length);
+
+// the characters of the view as a string of their own, NULL, allocating nothing, if it would not fit in the memory limit
+ObjString *view_string(ObjView *view);
+
+/*
+ * The string a String value other than a short one holds, flattening a rope or copying out a view,
+ * NULL if either would not fit in the memory limit.
+ */
+ObjString *text_string(Value value);
+
+// as text_string() but past the memory limit too, for what cannot stop halfway such as leaving the arena
+ObjString *text_string_unchecked(Value value);
+
+/*
+ * The TEXT_LENGTH characters of a String value, not terminated in a view, those of a short one are in the value itself,
+ * NULL if a rope would not fit in the memory limit.
+ */
+const char *text_chars(const Value *value);
+
+// ropes are flattened past the memory limit, the VM flattens its operands beforehand
+bool texts_equal(Value a, Value b);
+
+// the methods of Strings, called as text.name(arguments), each with a fixed number of arguments
+typedef enum {
+    METHOD_FIND, METHOD_COUNT, METHOD_CONTAINS, METHOD_STARTS_WITH, METHOD_SPLIT, METHOD_REPLACE,
+} StringMethod;
+
+#define STRING_METHODS 6
+
+typedef struct {
+    const char *name;
+    int arity;
+} MethodSignature;
+
+extern const MethodSignature string_methods[STRING_METHODS];
+
+// the method with that name, -1 if there is none
+int find_string_method(const char *name, int length);
+
+// text with every occurrence of old, which is not empty, replaced, nil if it would not fit in the memory limit
+Value replace_text(Value text, Value old, Value replacement);
+
+/*
+ * Where the index-th piece of text split at each occurrence of separator, which is not empty, starts and
+ * how long it is. Negative indices count back from the last piece, returns false if there is no such piece.
+ */
+bool split_bounds(Value text, Value separator, int64_t index, int *start, int *length);
+
+// frees a string table together with the strings interned in it
+void free_strings(Hashmap *strings);
+
 #endif //FILANG_STRINGS_H
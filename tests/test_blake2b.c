@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <string.h>
+#include "../blake2b.h"
+
+/*
+ * Known answers for BLAKE2b, the 64 byte digest of "abc" from RFC 7693 appendix A and 32 byte
+ * digests, the size the bytecode cache uses, around the 128 byte block boundary.
+ */
+static int failures = 0;
+
+static void check(const char *name, const void *data, size_t length, size_t digest_size, const char *expected) {
+    uint8_t digest[BLAKE2B_MAX_DIGEST];
+    blake2b(data, length, digest, digest_size);
+
+    char hex[2 * BLAKE2B_MAX_DIGEST + 1];
+    for (size_t i = 0; i < digest_size; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+
+    if (strcmp(hex, expected) != 0) {
+        printf("FAIL %s (%zu bytes): %s, expected %s\n", name, length, hex, expected);
+        failures++;
+    }
+}
+
+int main() {
+    check("abc", "abc", 3, 64,
+          "ba80a53f981c4d0d6a2797b69f12f6e94c212f14685ac4b74b12bb6fdbffa2d1"
+          "7d87c5392aab792dc252d5de4533cc9518d38aa8dbf1925ab92386edd4009923");
+
+    check("empty", "", 0, 32, "0e5751c026e543b2e8ab2eb06099daa1d1e5df47778f7787faab45cdf12fe3a8");
+    check("abc", "abc", 3, 32, "bddd813c634239723171ef3fee98579b94964e3bb1cb3e427262c8c068d52319");
+    check("fox", "The quick brown fox jumps over the lazy dog", 43, 32,
+          "01718cec35cd3d796dd00020e0bfecb473ad23457d063b75eff29c0ffa2e58a9");
+
+    // byte i is i % 251
+    uint8_t bytes[1000];
+    for (int i = 0; i < 1000; i++) {
+        bytes[i] = (uint8_t) (i % 251);
+    }
+    check("one block", bytes, 128, 32, "c3582f71ebb2be66fa5dd750f80baae97554f3b015663c8be377cfcb2488c1d1");
+    check("block and a byte", bytes, 129, 32, "f7f3c46ba2564ff4c4c162da1f5b605f9f1c4aa6a20652a9f9a337c1a2f5b9c9");
+    check("many blocks", bytes, 1000, 32, "b372d0608f720c8c3dd41e9c8eecb10143b41abe520b616607e754bf79c08331");
+
+    return failures == 0 ? 0 : 1;
+}
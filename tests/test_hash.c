@@ -0,0 +1,241 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../hash.h"
+
+/*
+ * The seeded hashes: known answers for a fixed seed, the same whichever kernel hashes long strings,
+ * then spread over buckets, avalanche and 32 bit collisions for keys shaped like the ones scripts
+ * use, on both the short path and the striped one for LONG_HASH_MIN bytes and more. Built once per
+ * kernel, AVX2, SSE2 and portable.
+ */
+#define SEED 12345
+// of the hashes for SEED, worked out once and the same with every kernel
+#define STRINGS_DIGEST 0xf3c1613b2c48288cu
+#define NUMBERS_DIGEST 0xb130b2156f077a64u
+#define SKIPPED 77
+#define BUFFER_BYTES 70000
+#define BUCKET_BITS 16
+#define BUCKET_KEYS (1 << 20)
+
+static int failures = 0;
+
+static uint64_t state = 0x853C49E6748FEA9Bu;
+
+static uint64_t next_random() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+static void check(bool passed, const char *format, ...) {
+    if (passed) return;
+
+    va_list args;
+    va_start(args, format);
+    printf("FAIL ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    failures++;
+}
+
+// every length up to 600 then every 97th, each one from an odd offset, so both paths and their tails are covered
+static void check_known_answers(const char *buffer) {
+    uint64_t strings = 0;
+    for (int length = 0; length < BUFFER_BYTES; length += length < 600 ? 1 : 97) {
+        int offset = length % 7;
+        strings = strings * 31 + hash_string(buffer + offset, length - offset > 0 ? length - offset : 0);
+    }
+    check(strings == STRINGS_DIGEST, "strings hash to %016llx", (unsigned long long) strings);
+
+    uint64_t numbers = 0;
+    for (int64_t i = -1000; i < 1000; i++) {
+        numbers = numbers * 31 + hash_int(i * 0x10001);
+        numbers = numbers * 31 + hash_double((double) i / 8);
+    }
+    check(numbers == NUMBERS_DIGEST, "numbers hash to %016llx", (unsigned long long) numbers);
+}
+
+typedef void (*KeyWriter)(char *key, int *length, int64_t *integer, int i);
+
+static void small_integer(char *, int *length, int64_t *integer, int i) { *length = -1; *integer = i; }
+static void shifted_integer(char *, int *length, int64_t *integer, int i) { *length = -1; *integer = i * (1L << 20); }
+static void page_integer(char *, int *length, int64_t *integer, int i) { *length = -1; *integer = i * 4096L; }
+static void named_key(char *key, int *length, int64_t *, int i) { *length = sprintf(key, "key%d", i); }
+static void padded_number(char *key, int *length, int64_t *, int i) { *length = sprintf(key, "%08d", i); }
+static void identifier(char *key, int *length, int64_t *, int i) { *length = sprintf(key, "identifier_%d", i); }
+
+// keys that only differ in their last 4 bytes
+static void long_tail(char *key, int *length, int64_t *, int i) {
+    memset(key, 'x', 36);
+    memcpy(key + 36, &i, 4);
+    *length = 40;
+}
+
+// striped keys that only differ in 4 bytes in the middle
+static void striped_middle(char *key, int *length, int64_t *, int i) {
+    memset(key, 'y', 1500);
+    memcpy(key + 700, &i, 4);
+    *length = 1500;
+}
+
+static uint32_t hash_key(KeyWriter writer, char *key, int i) {
+    int length;
+    int64_t integer;
+    writer(key, &length, &integer, i);
+    return length < 0 ? hash_int(integer) : hash_string(key, length);
+}
+
+/*
+ * Chi-squared over the low bits, the ones a table takes for its slot: with 16 keys a bucket it is
+ * close to the number of buckets, 65535 give or take 362; more than 6 deviations over fails.
+ */
+static void check_buckets(const char *name, KeyWriter writer, int keys) {
+    static uint32_t counts[1 << BUCKET_BITS];
+    memset(counts, 0, sizeof(counts));
+
+    char key[2048];
+    for (int i = 0; i < keys; i++) {
+        counts[hash_key(writer, key, i) & ((1 << BUCKET_BITS) - 1)]++;
+    }
+
+    double expected = (double) keys / (1 << BUCKET_BITS);
+    double chi_squared = 0;
+    for (int i = 0; i < 1 << BUCKET_BITS; i++) {
+        chi_squared += (counts[i] - expected) * (counts[i] - expected) / expected;
+    }
+
+    double buckets = (1 << BUCKET_BITS) - 1;
+    check(chi_squared < buckets + 6 * sqrt(2 * buckets), "%s keys fill the buckets unevenly, chi-squared %.0f",
+          name, chi_squared);
+}
+
+static int compare_hashes(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+// pairs of keys among count with the same 32 bit hash: count^2 / 2^33 expected, more than twice as many fails
+static void check_collisions(const char *name, KeyWriter writer, int keys) {
+    uint32_t *hashes = malloc(sizeof(uint32_t) * keys);
+    char key[2048];
+    for (int i = 0; i < keys; i++) {
+        hashes[i] = hash_key(writer, key, i);
+    }
+
+    qsort(hashes, keys, sizeof(uint32_t), compare_hashes);
+    int collisions = 0;
+    for (int i = 1; i < keys; i++) {
+        collisions += hashes[i] == hashes[i - 1];
+    }
+    free(hashes);
+
+    double expected = (double) keys * keys / 8589934592.0;
+    check(collisions <= 2 * expected + 8, "%s keys collide %d times, about %.0f expected", name, collisions, expected);
+}
+
+/*
+ * Flipping any one bit of a key flips each bit of its hash half of the time. The share is checked for
+ * each input bit, over 32 output bits and 64 keys, and for each output bit, over every input bit;
+ * n flips of a fair coin are off from half by 0.5 / sqrt(n), more than 6 times that fails.
+ */
+static bool fair_share(double share, long samples) {
+    return fabs(share - 0.5) < 6 * 0.5 / sqrt((double) samples);
+}
+
+static void check_avalanche(int length) {
+    enum { KEYS = 64 };
+    int bits = length * 8;
+    int sampled = bits < 256 ? bits : 256;
+    long output_flips[32] = {0};
+
+    char key[2048];
+    for (int s = 0; s < sampled; s++) {
+        int bit = bits <= 256 ? s : (int) (next_random() % bits);
+        long flips = 0;
+
+        for (int k = 0; k < KEYS; k++) {
+            for (int i = 0; i < length; i++) {
+                key[i] = (char) next_random();
+            }
+            uint32_t before = hash_string(key, length);
+            key[bit / 8] ^= (char) (1 << bit % 8);
+            uint32_t changed = before ^ hash_string(key, length);
+
+            flips += __builtin_popcount(changed);
+            for (int o = 0; o < 32; o++) {
+                output_flips[o] += changed >> o & 1;
+            }
+        }
+
+        double share = (double) flips / (KEYS * 32);
+        if (!fair_share(share, KEYS * 32)) {
+            check(false, "flipping bit %d of %d byte keys flips %.3f of the hash", bit, length, share);
+            return;
+        }
+    }
+
+    for (int o = 0; o < 32; o++) {
+        double share = (double) output_flips[o] / ((long) sampled * KEYS);
+        check(fair_share(share, (long) sampled * KEYS), "hash bit %d of %d byte keys flips %.3f of the time",
+              o, length, share);
+    }
+}
+
+int main() {
+#if defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("AVX2 is not supported here\n");
+        return SKIPPED;
+    }
+#endif
+
+    set_hash_seed(SEED);
+
+    char *buffer = malloc(BUFFER_BYTES);
+    for (int i = 0; i < BUFFER_BYTES; i++) {
+        buffer[i] = (char) (i * 131 + (i >> 7));
+    }
+    check_known_answers(buffer);
+
+    static const struct {
+        const char *name;
+        KeyWriter writer;
+    } families[] = {
+            {"0..n",            small_integer},
+            {"i << 20",         shifted_integer},
+            {"i * 4096",        page_integer},
+            {"\"key%d\"",       named_key},
+            {"\"%08d\"",        padded_number},
+            {"40 byte",         long_tail},
+            {"1500 byte",       striped_middle},
+    };
+    for (size_t i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+        check_buckets(families[i].name, families[i].writer, BUCKET_KEYS);
+    }
+
+    check_collisions("\"identifier_%d\"", identifier, 1 << 20);
+    check_collisions("1500 byte", striped_middle, 1 << 18);
+
+    int lengths[] = {3, 8, 24, 100, 1023, 1024, 2000};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        check_avalanche(lengths[i]);
+    }
+
+    check(hash_double(0.0) == hash_double(-0.0), "0.0 and -0.0 hash differently");
+
+    // another seed changes every hash, short and striped alike
+    uint32_t short_hash = hash_string("identifier", 10), long_hash = hash_string(buffer, 5000);
+    set_hash_seed(SEED + 1);
+    check(hash_string("identifier", 10) != short_hash && hash_string(buffer, 5000) != long_hash,
+          "hashes do not depend on the seed");
+
+    free(buffer);
+    if (failures > 0) printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../number_format.h"
+
+/*
+ * Decimals must read back as the same double, with the fewest digits that do, the closest ones to it
+ * when there are several, laid out as "%g" lays them out. The reference is worked out from printf's
+ * "%e" and strtod. Integers are compared with "%" PRId64.
+ */
+#define DECIMAL_CASES 200000
+#define INTEGER_CASES 2000000
+
+static int failures = 0;
+
+static uint64_t state = 0x853C49E6748FEA9Bu;
+
+static uint64_t next_random() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+static void fail(const char *what, double value, const char *got, const char *expected) {
+    if (failures++ < 20) printf("FAIL %s %a: \"%s\", expected \"%s\"\n", what, value, got, expected);
+}
+
+static bool reads_back(uint64_t mantissa, int exponent, double value) {
+    char text[48];
+    snprintf(text, sizeof(text), "%" PRIu64 "e%d", mantissa, exponent);
+    return strtod(text, NULL) == value;
+}
+
+// leading digits of text, a "%e" formatted number, as an integer, and the power of ten it is then scaled by
+static uint64_t leading_digits(const char *text, int digits, int *exponent) {
+    uint64_t mantissa = 0;
+    int taken = 0;
+    const char *p = text;
+    for (; *p != 'e'; p++) {
+        if (*p != '.' && taken < digits) {
+            mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+            taken++;
+        }
+    }
+    *exponent = atoi(p + 1) - (taken - 1);
+    return mantissa;
+}
+
+/*
+ * The fewest significant digits that read back, laid out as "%g" would. At each precision the
+ * correctly rounded digits are the closest and win if they read back; next to a power of two the
+ * interval that rounds to value is lopsided, so the digits one step below or above them may read
+ * back when they do not.
+ */
+static void reference_decimal(double value, char *buffer) {
+    double magnitude = fabs(value);
+    char exact[64];
+    snprintf(exact, sizeof(exact), "%.40e", magnitude);
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    for (int precision = 1; precision <= 17; precision++) {
+        char rounded[32];
+        snprintf(rounded, sizeof(rounded), "%.*e", precision - 1, magnitude);
+        mantissa = leading_digits(rounded, precision, &exponent);
+        if (reads_back(mantissa, exponent, magnitude)) break;
+
+        mantissa = leading_digits(exact, precision, &exponent);
+        if (reads_back(mantissa, exponent, magnitude)) break;
+        if (reads_back(++mantissa, exponent, magnitude)) break;
+    }
+
+    while (mantissa % 10 == 0) {
+        mantissa /= 10;
+        exponent++;
+    }
+
+    char digits[24];
+    int count = sprintf(digits, "%" PRIu64, mantissa);
+    // of the first digit
+    exponent += count - 1;
+
+    char *out = buffer;
+    if (signbit(value)) *out++ = '-';
+    if (exponent < -4 || exponent >= 15) {
+        out += sprintf(out, "%c", digits[0]);
+        if (count > 1) out += sprintf(out, ".%s", digits + 1);
+        sprintf(out, "e%c%02d", exponent < 0 ? '-' : '+', abs(exponent));
+    } else if (exponent < 0) {
+        out += sprintf(out, "0.");
+        for (int i = -1; i > exponent; i--) *out++ = '0';
+        strcpy(out, digits);
+    } else if (exponent + 1 >= count) {
+        out += sprintf(out, "%s", digits);
+        for (int i = count; i <= exponent; i++) *out++ = '0';
+        *out = '\0';
+    } else {
+        sprintf(out, "%.*s.%s", exponent + 1, digits, digits + exponent + 1);
+    }
+}
+
+static void check_decimal(double value) {
+    char buffer[NUMBER_BUFFER];
+    int length = format_decimal(value, buffer);
+    if (length != (int) strlen(buffer) || length >= NUMBER_BUFFER) {
+        fail("length of", value, buffer, "");
+        return;
+    }
+
+    if (isnan(value) || isinf(value)) {
+        char expected[16];
+        snprintf(expected, sizeof(expected), "%g", value);
+        if (strcmp(buffer, expected) != 0) fail("special", value, buffer, expected);
+        return;
+    }
+
+    double read = strtod(buffer, NULL);
+    if (memcmp(&read, &value, sizeof(value)) != 0) {
+        fail("round trip of", value, buffer, "");
+        return;
+    }
+
+    char expected[64];
+    if (value == 0) {
+        strcpy(expected, signbit(value) ? "-0" : "0");
+    } else {
+        reference_decimal(value, expected);
+    }
+    if (strcmp(buffer, expected) != 0) fail("shortest digits of", value, buffer, expected);
+}
+
+static void check_layout(double value, const char *expected) {
+    char buffer[NUMBER_BUFFER];
+    format_decimal(value, buffer);
+    if (strcmp(buffer, expected) != 0) fail("layout of", value, buffer, expected);
+}
+
+static void check_integer(int64_t value) {
+    char buffer[NUMBER_BUFFER];
+    char expected[32];
+    int length = format_integer(value, buffer);
+    snprintf(expected, sizeof(expected), "%" PRId64, value);
+    if (length != (int) strlen(expected) || strcmp(buffer, expected) != 0) {
+        fail("integer", (double) value, buffer, expected);
+    }
+}
+
+int main() {
+    check_layout(0.1, "0.1");
+    check_layout(0.1 + 0.2, "0.30000000000000004");
+    check_layout(100, "100");
+    check_layout(123456789012345.0, "123456789012345");
+    check_layout(1e15, "1e+15");
+    check_layout(1e100, "1e+100");
+    check_layout(0.0001, "0.0001");
+    check_layout(0.00001, "1e-05");
+    check_layout(-1.5e-7, "-1.5e-07");
+    check_layout(2.5, "2.5");
+    check_layout(0.0, "0");
+    check_layout(-0.0, "-0");
+    check_layout(INFINITY, "inf");
+    check_layout(-INFINITY, "-inf");
+    check_layout(NAN, "nan");
+    check_layout(5e-324, "5e-324");
+    check_layout(1.7976931348623157e308, "1.7976931348623157e+308");
+    check_layout(9007199254740993.0, "9.007199254740992e+15");
+
+    // every power of two and of ten in range, and their neighbours
+    for (int e = -1074; e <= 1023; e++) {
+        double value = ldexp(1, e);
+        check_decimal(value);
+        check_decimal(nextafter(value, 0));
+        check_decimal(nextafter(value, INFINITY));
+    }
+    for (int e = -323; e <= 308; e++) {
+        char text[16];
+        snprintf(text, sizeof(text), "1e%d", e);
+        double value = strtod(text, NULL);
+        check_decimal(value);
+        check_decimal(nextafter(value, 0));
+        check_decimal(nextafter(value, INFINITY));
+    }
+
+    for (int i = 0; i < DECIMAL_CASES; i++) {
+        uint64_t bits = next_random();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        check_decimal(value);
+
+        // short decimals, as scripts write them
+        int64_t digits = (int64_t) (next_random() % 2000001) - 1000000;
+        check_decimal((double) digits / pow(10, (double) (next_random() % 12)));
+    }
+
+    int64_t edges[] = {0, 1, -1, 9, 10, -10, 99, 100, INT64_MAX, INT64_MIN, INT64_MAX - 1, INT64_MIN + 1};
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        check_integer(edges[i]);
+    }
+    for (int64_t power = 1; power <= INT64_MAX / 10; power *= 10) {
+        check_integer(power - 1);
+        check_integer(power);
+        check_integer(-power);
+        check_integer(-power + 1);
+    }
+    for (int i = 0; i < INTEGER_CASES; i++) {
+        uint64_t bits = next_random();
+        check_integer((int64_t) bits);
+        check_integer((int64_t) bits >> (bits & 63));
+    }
+
+    if (failures > 0) printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
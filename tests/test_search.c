@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../search.h"
+
+/*
+ * search_text() and count_text() against a byte at a time search, on short random haystacks over
+ * small alphabets so that partial matches are common. Haystacks and needles are placed right after
+ * and right before an inaccessible page, so a load past either end faults. Built once per kernel,
+ * AVX2, SSE2 and portable, since each one has its own vector width and tail.
+ */
+#define CASES 2000000
+#define MAX_HAYSTACK 200
+#define SKIPPED 77
+
+static uint64_t state = 0x853C49E6748FEA9Bu;
+
+static uint64_t next_random() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+// random letters among the first alphabet ones, two random bits for each
+static void random_text(char *text, int length, int alphabet) {
+    uint64_t bits = 0;
+    for (int i = 0; i < length; i++) {
+        if (i % 32 == 0) bits = next_random();
+        text[i] = (char) ('a' + (int) (bits & 3) % alphabet);
+        bits >>= 2;
+    }
+}
+
+static bool matches_at(const char *haystack, const char *needle, int needle_length) {
+    for (int i = 0; i < needle_length; i++) {
+        if (haystack[i] != needle[i]) return false;
+    }
+    return true;
+}
+
+static int naive_search(const char *haystack, int length, const char *needle, int needle_length) {
+    for (int i = 0; i + needle_length <= length; i++) {
+        if (matches_at(haystack + i, needle, needle_length)) return i;
+    }
+    return -1;
+}
+
+static int naive_count(const char *haystack, int length, const char *needle, int needle_length) {
+    if (needle_length == 0) return length + 1;
+
+    int count = 0;
+    for (int i = 0; i + needle_length <= length;) {
+        if (matches_at(haystack + i, needle, needle_length)) {
+            count++;
+            i += needle_length;
+        } else {
+            i++;
+        }
+    }
+    return count;
+}
+
+// a page that can be read and written between two that cannot be touched at all
+static char *guarded_page(long page_size) {
+    char *mapping = mmap(NULL, 3 * page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED || mprotect(mapping + page_size, page_size, PROT_READ | PROT_WRITE) != 0) return NULL;
+    return mapping + page_size;
+}
+
+int main() {
+#if defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("AVX2 is not supported here\n");
+        return SKIPPED;
+    }
+#endif
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    char *haystack_page = guarded_page(page_size);
+    char *needle_page = guarded_page(page_size);
+    if (haystack_page == NULL || needle_page == NULL) {
+        printf("Could not map the guarded pages\n");
+        return 1;
+    }
+
+    char haystack[MAX_HAYSTACK];
+    char needle[MAX_HAYSTACK];
+    int failures = 0;
+
+    for (int i = 0; i < CASES && failures < 20; i++) {
+        int length = (int) (next_random() % MAX_HAYSTACK);
+        int needle_length = (int) (next_random() % (next_random() % 10 == 0 ? 40 : 6));
+        int alphabet = (int) (2 + next_random() % 3);
+
+        random_text(haystack, length, alphabet);
+        random_text(needle, needle_length, alphabet);
+        if (needle_length > 0 && needle_length <= length && next_random() % 2 == 0) {
+            memcpy(needle, haystack + next_random() % (length - needle_length + 1), needle_length);
+        }
+
+        int found = naive_search(haystack, length, needle, needle_length);
+        int count = naive_count(haystack, length, needle, needle_length);
+
+        // the needle always ends against the guard, the haystack starts against one then ends against the other
+        char *guarded_needle = needle_page + page_size - needle_length;
+        memcpy(guarded_needle, needle, needle_length);
+
+        for (int placement = 0; placement < 2; placement++) {
+            char *guarded_haystack = placement == 0 ? haystack_page : haystack_page + page_size - length;
+            memcpy(guarded_haystack, haystack, length);
+
+            int searched = search_text(guarded_haystack, length, guarded_needle, needle_length);
+            int counted = count_text(guarded_haystack, length, guarded_needle, needle_length);
+
+            if (searched != found || counted != count) {
+                printf("FAIL \"%.*s\" in \"%.*s\": found at %d counted %d, expected %d and %d\n",
+                       needle_length, needle, length, haystack, searched, counted, found, count);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
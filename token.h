@@ -6,6 +6,7 @@ typedef enum {
     //parenthesis
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
 
     //operators
     TOKEN_COMMA, TOKEN_DOT,
@@ -31,9 +32,10 @@ typedef enum {
 
     //literals
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_INTEGER, TOKEN_FLOAT,
+    TOKEN_INTERPOLATION,
 
     //keywords
-    TOKEN_RETURN,
+    TOKEN_RETURN, TOKEN_IMPORT,
 
     //conditionals
     TOKEN_IF, TOKEN_ELSE,
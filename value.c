@@ -1,6 +1,7 @@
 #include "value.h"
 #include "memory.h"
 #include "strings.h"
+#include "number_format.h"
 #include <stddef.h>
 #include <stdio.h>
 
@@ -14,34 +15,39 @@ void write_value_array(ValueArray *array, Value value) {
     if (array->count + 1 >= array->capacity) {
         int old_capacity = array->capacity;
         array->capacity = GROW_ARRAY_CAPACITY(array->capacity);
-        array->values = GROW_ARRAY(array->values, Value, old_capacity, array->capacity);
+        array->values = GROW_ARRAY(array->values, Value, old_capacity, array->capacity, MEMORY_CONSTANTS);
     }
 
     array->values[(array->count)++] = value;
 }
 
 void free_value_array(ValueArray *array) {
-    FREE_ARRAY(array->values, Value, array->capacity);
+    FREE_ARRAY(array->values, Value, array->capacity, MEMORY_CONSTANTS);
     init_value_array(array);
 }
 
 void print_value(Value value) {
+    char buffer[NUMBER_BUFFER];
+
     switch (value.type) {
         case TYPE_BOOL:
             printf(value.as.integer == 0 ? "false" : "true");
             break;
         case TYPE_DECIMAL:
-            printf("%.15g", value.as.decimal);
+            fwrite(buffer, 1, format_decimal(value.as.decimal, buffer), stdout);
             break;
         case TYPE_INTEGER:
-            printf("%ld", value.as.integer);
+            fwrite(buffer, 1, format_integer(value.as.integer, buffer), stdout);
             break;
         case TYPE_NIL:
             printf("nil");
             break;
+        case TYPE_SHORT_STRING:
+            printf("%s", value.as.chars);
+            break;
         case TYPE_OBJECT:
-            if (IS_STRING(value))
-                printf("%s", ((ObjString *) value.as.object)->chars);
+            if (IS_TEXT(value))
+                printf("%.*s", TEXT_LENGTH(value), text_chars(&value));
             else
                 printf("%s", type_to_string(value));
             break;
@@ -12,7 +12,8 @@ typedef enum {
     TYPE_DECIMAL,
     TYPE_INTEGER,
     TYPE_OBJECT,
-    TYPE_NIL
+    TYPE_NIL,
+    TYPE_SHORT_STRING
 } ValueType;
 
 
@@ -24,6 +25,7 @@ typedef struct {
         double decimal;
         int64_t integer;
         Object *object;
+        char chars[8];      // a short string, see SHORT_STRING_MAX
     } as;
 } Value;
 
@@ -34,11 +36,17 @@ typedef struct {
 } ValueArray;
 
 typedef enum {
-    OBJ_STRING
+    OBJ_STRING,
+    OBJ_ROPE,
+    OBJ_VIEW
 } Objtype;
 
 struct Object {
     Objtype type;
+    bool marked;
+    bool external;      // lives in a mapped file, it is never written to nor freed
+    bool interned;      // in a string table, the pieces of a rope are not
+    struct Object *next;
 };
 
 
@@ -47,7 +55,7 @@ struct Object {
 #define IS_FLOAT(value) ((value).type == TYPE_DECIMAL)
 #define IS_INTEGER(value) (((value).type == TYPE_INTEGER) || IS_BOOL(value))
 #define IS_NUMERIC(value) (IS_FLOAT(value) || IS_INTEGER(value) || IS_BOOL(value))
-#define IS_NIL(value) ((value).type == VAL_NIL)
+#define IS_NIL(value) ((value).type == TYPE_NIL)
 
 #define NEW_OBJECT(value) ((Value){TYPE_OBJECT, {.object = (Object *) (value)}})
 #define NEW_BOOL(value) ((value) ? (Value){TYPE_BOOL, {.integer = true}} : (Value){TYPE_BOOL, {.integer = false}})
@@ -4,10 +4,14 @@
 #include <string.h>
 #include <time.h>
 #include <malloc.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include "vm.h"
 #include "chunk.h"
 #include "compiler.h"
 #include "strings.h"
+#include "search.h"
 #include "memory.h"
 
 
@@ -25,14 +29,41 @@ static void init_locals() {
 
 void init_vm() {
     reset_stack();
+    init_hash_seed();
     init_hashmap(&vm.strings);
+    init_hashmap(&vm.modules);
     init_locals();
+    vm.chunk = NULL;
+    vm.suspended = NULL;
+    vm.script_path = NULL;
+    vm.redefining = false;
+    vm.objects = NULL;
+    vm.gray.objects = NULL;
+    vm.gray.count = 0;
+    vm.gray.capacity = 0;
+    init_slabs(&vm.slabs);
+    vm.allocator = system_allocator;
+    vm.heap_allocator = system_allocator;
+    vm.arena = NULL;
+    init_value_array(&vm.arena_globals);
+    vm.memory_limit = 0;
+    vm.memory_stats = false;
+    vm.memory_used = 0;
+    for (int i = 0; i <= MEMORY_CATEGORY_COUNT; i++) {
+        vm.memory[i] = (MemoryCounters) {0, 0, 0, 0};
+    }
+    vm.bytes_allocated = 0;
+    vm.gc_threshold = GC_DEFAULT_THRESHOLD;
+    vm.next_gc = vm.gc_threshold;
 }
 
 void free_vm() {
+    free_objects();
     free_hashmap(&vm.strings);
     free_hashmap(&vm.globals);
-    free(vm.locals.local);
+    free_hashmap(&vm.modules);
+    FREE_ARRAY(vm.locals.local, Value, vm.locals.capacity, MEMORY_LOCALS);
+    FREE_ARRAY(vm.gray.objects, Object *, vm.gray.capacity, MEMORY_TEMPORARY);
 }
 
 static void push(Value value) {
@@ -67,9 +98,11 @@ static bool is_true(Value value) {
             return value.as.integer != 0;
         case TYPE_DECIMAL:
             return value.as.decimal != 0;
+        case TYPE_SHORT_STRING:
+            return SHORT_STRING_LENGTH(value) != 0;
         case TYPE_OBJECT:
-            if (IS_STRING(value))
-                return ((ObjString *) value.as.object)->length != 0;
+            if (IS_TEXT(value))
+                return TEXT_LENGTH(value) != 0;
             else
                 return true;
         default:
@@ -82,15 +115,8 @@ static void runtime_error(const char *format, ...) {
     va_start(args, format);
     size_t instruction = vm.ip - vm.chunk->code - 1;
 
-    int line = 1;
-    for (int i = 0; i < vm.chunk->lines.count; i++) {
-        if ((size_t) vm.chunk->lines.ends[i] > instruction && vm.chunk->lines.ends[i] != -1) {
-            line = i + 1;
-            break;
-        }
-    }
-
-    fprintf(stderr, "[line %d] RuntimeError: ", line);
+    LinePosition position = find_line(&vm.chunk->lines, (int) instruction);
+    fprintf(stderr, "[line %d, column %d] RuntimeError: ", position.line, position.column);
     vfprintf(stderr, format, args);
     fprintf(stderr, "\n");
     va_end(args);
@@ -98,18 +124,15 @@ static void runtime_error(const char *format, ...) {
 }
 
 static void set_local(size_t slot, Value value) {
-    if (slot < vm.locals.size) {
-    } else if (slot < vm.locals.capacity) {
-        vm.locals.size++;
-    } else if (slot >= vm.locals.capacity) {
+    while (slot >= vm.locals.capacity) {
         int old_capacity = vm.locals.capacity;
         vm.locals.capacity = GROW_ARRAY_CAPACITY(old_capacity);
-        vm.locals.local = GROW_ARRAY(vm.locals.local, Value, old_capacity, vm.locals.capacity);
+        vm.locals.local = GROW_ARRAY(vm.locals.local, Value, old_capacity, vm.locals.capacity, MEMORY_LOCALS);
+    }
 
-        if (vm.locals.local == NULL) {
-            runtime_error("An error occurred.");
-            return;
-        }
+    // the collector reads the slots below size, any skipped over must hold a value
+    while (vm.locals.size <= slot) {
+        vm.locals.local[vm.locals.size++] = NIL;
     }
 
     vm.locals.local[slot] = value;
@@ -120,10 +143,180 @@ static void set_local(size_t slot, Value value) {
 #define READ_BYTE() (*(vm.ip++))
 #define NEXT_BYTE() (*(vm.ip))
 #define READ_CONSTANT_INDEX() (READ_BYTE())
-#define READ_CONSTANT_LONG_INDEX() (READ_BYTE() + (READ_BYTE()<<8))
-#define READ_CONSTANT_LONG_LONG_INDEX() (READ_BYTE() + (READ_BYTE()<<8) + (READ_BYTE()<<16))
+// the operand bytes are read through the advanced ip, the order of several READ_BYTE() in one expression is unspecified
+#define READ_CONSTANT_LONG_INDEX() (vm.ip += 2, vm.ip[-2] + (vm.ip[-1]<<8))
+#define READ_CONSTANT_LONG_LONG_INDEX() (vm.ip += 3, vm.ip[-3] + (vm.ip[-2]<<8) + (vm.ip[-1]<<16))
+#define READ_WIDE_INDEX() (vm.ip += 4, vm.ip[-4] + (vm.ip[-3]<<8) + (vm.ip[-2]<<16) + ((size_t) vm.ip[-1]<<24))
 #define READ_CONSTANT(index) (vm.chunk->constants.values[index])
 #define HAS_DECIMAL_DIGITS(val) !(floor(val) == val)
+/*
+ * Only used once the new object is on the stack, where the collector finds it. Past the budget
+ * whatever garbage there is gets collected before giving up.
+ */
+#define COLLECT_IF_NEEDED() do { \
+    if (vm.bytes_allocated > vm.next_gc) collect_garbage(); \
+    if (!within_budget(0)) { \
+        collect_garbage(); \
+        if (!within_budget(0)) return memory_error(); \
+    } \
+} while (false)
+
+static InterpretResult memory_error() {
+    if (vm.memory_limit == 0) {
+        // without a limit only a string too long for its length field gets here
+        runtime_error("string too long.");
+    } else {
+        runtime_error("memory limit of %zu bytes exceeded.", vm.memory_limit);
+    }
+    return RUNTIME_ERROR;
+}
+
+// the values stay on the stack meanwhile, a collection may make room for the result
+static Value concatenate(const Value *values, int count) {
+    Value string = concatenate_values(values, count);
+    if (!IS_NIL(string)) return string;
+
+    collect_garbage();
+    return concatenate_values(values, count);
+}
+
+// a rope is replaced by its flattened string before its characters are read, as for concatenate()
+static bool flatten_operand(Value *operand) {
+    if (!IS_ROPE(*operand)) return true;
+
+    ObjString *string = flatten_rope(AS_ROPE(*operand));
+    if (string == NULL) {
+        collect_garbage();
+        string = flatten_rope(AS_ROPE(*operand));
+    }
+    if (string == NULL) return false;
+
+    *operand = NEW_OBJECT(string);
+    return true;
+}
+
+// a nil bound is the end it stands for, a negative one counts from the end of the string
+static int64_t slice_bound(Value bound, int64_t length, int64_t missing) {
+    if (IS_NIL(bound)) return missing;
+
+    int64_t index = bound.as.integer < 0 ? bound.as.integer + length : bound.as.integer;
+    return index < 0 ? 0 : index > length ? length : index;
+}
+
+static Value slice_or_collect(Value text, int start, int length) {
+    Value result = slice_text(text, start, length);
+    if (!IS_NIL(result)) return result;
+
+    collect_garbage();
+    return slice_text(text, start, length);
+}
+
+// the operands stay on the stack meanwhile, as for concatenate()
+static Value slice(const Value *operands) {
+    int64_t length = TEXT_LENGTH(operands[0]);
+    int64_t start = slice_bound(operands[1], length, 0);
+    int64_t end = slice_bound(operands[2], length, length);
+    if (end < start) end = start;
+
+    return slice_or_collect(operands[0], (int) start, (int) (end - start));
+}
+
+/*
+ * Replaces the receiver and the arguments of a String method, operands[0] to operands[arity], with its result.
+ * They stay on the stack until then, so that a collection run to make room for the result keeps them.
+ */
+static InterpretResult call_method(StringMethod method, Value *operands) {
+    const char *name = string_methods[method].name;
+    int arity = string_methods[method].arity;
+
+    if (!IS_TEXT(operands[0])) {
+        runtime_error("unsupported receiver type for %s(): %s.", name, type_to_string(operands[0]));
+        return RUNTIME_ERROR;
+    }
+    for (int i = 1; i <= arity; i++) {
+        if (!IS_TEXT(operands[i]) && !(method == METHOD_SPLIT && i == 2)) {
+            runtime_error("%s() argument must be a String, not %s.", name, type_to_string(operands[i]));
+            return RUNTIME_ERROR;
+        }
+    }
+
+    for (int i = 0; i <= arity; i++) {
+        if (!flatten_operand(&operands[i])) return memory_error();
+    }
+
+    const char *chars = text_chars(&operands[0]);
+    int length = TEXT_LENGTH(operands[0]);
+    const char *argument = text_chars(&operands[1]);
+    int argument_length = TEXT_LENGTH(operands[1]);
+    if ((method == METHOD_SPLIT || method == METHOD_REPLACE) && argument_length == 0) {
+        runtime_error("%s() argument must not be empty.", name);
+        return RUNTIME_ERROR;
+    }
+
+    Value result;
+    int start, piece_length;
+    switch (method) {
+        case METHOD_FIND:
+            result = NEW_INTEGER(search_text(chars, length, argument, argument_length));
+            break;
+        case METHOD_COUNT:
+            result = NEW_INTEGER(count_text(chars, length, argument, argument_length));
+            break;
+        case METHOD_CONTAINS:
+            result = NEW_BOOL(search_text(chars, length, argument, argument_length) >= 0);
+            break;
+        case METHOD_STARTS_WITH:
+            result = NEW_BOOL(argument_length <= length && memcmp(chars, argument, argument_length) == 0);
+            break;
+        case METHOD_SPLIT:
+            if (!IS_INTEGER(operands[2])) {
+                runtime_error("split() index must be an integer, not %s.", type_to_string(operands[2]));
+                return RUNTIME_ERROR;
+            }
+
+            // the pieces are sliced out of the receiver, none of them is copied or interned
+            if (!split_bounds(operands[0], operands[1], operands[2].as.integer, &start, &piece_length)) {
+                result = NIL;
+                break;
+            }
+            result = slice_or_collect(operands[0], start, piece_length);
+            if (IS_NIL(result)) return memory_error();
+            break;
+        case METHOD_REPLACE:
+            result = replace_text(operands[0], operands[1], operands[2]);
+            if (IS_NIL(result)) {
+                collect_garbage();
+                result = replace_text(operands[0], operands[1], operands[2]);
+            }
+            if (IS_NIL(result)) return memory_error();
+            break;
+        default:
+            runtime_error("An error occurred.");
+            return RUNTIME_ERROR;
+    }
+
+    pop_n(arity + 1);
+    push(result);
+    return NO_ERRORS;
+}
+
+/*
+ * Strings made at runtime are interned once stored in a global, those only printed or compared never are.
+ * A view is copied out first, after a collection if it does not fit at first, false if it still does not.
+ */
+static bool intern_global_value(Value *value) {
+    if (!IS_STRING(*value) && !IS_VIEW(*value)) return true;
+
+    ObjString *string = text_string(*value);
+    if (string == NULL) {
+        collect_garbage();
+        string = text_string(*value);
+    }
+    if (string == NULL) return false;
+
+    *value = NEW_OBJECT(intern_runtime_string(string));
+    return true;
+}
 
 static size_t read_generic_constant_index() {
     switch (READ_BYTE()) {
@@ -140,6 +333,8 @@ static size_t read_generic_constant_index() {
 }
 
 
+static InterpretResult import_module(const char *path);
+
 InterpretResult execute() {
 #define BINARY_NUMBER_OPERATION(castBool, operator, string_operator)                                                                            \
     do {                                                                                                                                        \
@@ -200,13 +395,25 @@ InterpretResult execute() {
                 push(NIL);
                 break;
             case OP_ADD:
-                if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
-                    push(NEW_OBJECT(concatenate_strings(value_to_string(pop()), value_to_string(pop()))));
+                if (IS_TEXT(peek(0)) || IS_TEXT(peek(1))) {
+                    temp = concatenate(peek_pointer(1), 2);
+                    if (IS_NIL(temp)) return memory_error();
+                    pop_n(2);
+                    push(temp);
+                    COLLECT_IF_NEEDED();
                     break;
                 }
 
                 BINARY_NUMBER_OPERATION(false, +, "+");
                 break;
+            case OP_CONCAT_N:
+                index = READ_BYTE();
+                temp = concatenate(peek_pointer((int) index - 1), (int) index);
+                if (IS_NIL(temp)) return memory_error();
+                pop_n((int) index);
+                push(temp);
+                COLLECT_IF_NEEDED();
+                break;
             case OP_SUBTRACT:
                 BINARY_NUMBER_OPERATION(false, -, "-");
                 break;
@@ -243,6 +450,7 @@ InterpretResult execute() {
                 push(HAS_DECIMAL_DIGITS(resd) ? NEW_DECIMAL(resd) : NEW_INTEGER((int64_t) resd));
                 break;
             case OP_PRINT:
+                if (!flatten_operand(peek_pointer(0))) return memory_error();
                 print_value(pop());
                 printf("\n");
                 break;
@@ -276,6 +484,7 @@ InterpretResult execute() {
                                 break;
                             case TYPE_OBJECT:
                             case TYPE_NIL:
+                            case TYPE_SHORT_STRING:
                                 push(NEW_BOOL(false));
                                 break;
                         }
@@ -291,13 +500,21 @@ InterpretResult execute() {
                                 break;
                             case TYPE_OBJECT:
                             case TYPE_NIL:
+                            case TYPE_SHORT_STRING:
                                 push(NEW_BOOL(false));
                                 break;
                         }
                         break;
                     case TYPE_OBJECT:
-                        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                            push(NEW_BOOL(AS_STRING(pop()) == AS_STRING(pop())));
+                    case TYPE_SHORT_STRING:
+                        if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) {
+                            // texts of different lengths are told apart without flattening either
+                            if (TEXT_LENGTH(peek(0)) == TEXT_LENGTH(peek(1)) &&
+                                (!flatten_operand(peek_pointer(0)) || !flatten_operand(peek_pointer(1)))) {
+                                return memory_error();
+                            }
+                            temp = pop();
+                            push(NEW_BOOL(texts_equal(pop(), temp)));
                         } else {
                             push(NEW_BOOL(false));
                         }
@@ -374,6 +591,7 @@ InterpretResult execute() {
                 break;
             case OP_POP:
                 if (vm.repl) {
+                    if (!flatten_operand(peek_pointer(0))) return memory_error();
                     print_value(pop());
                     printf("\n");
                 } else {
@@ -384,7 +602,9 @@ InterpretResult execute() {
                 index = read_generic_constant_index();
                 temp = READ_CONSTANT(index);
 
-                if (add_entry(&vm.globals, temp, pop())) {
+                if (!intern_global_value(peek_pointer(0))) return memory_error();
+                if (vm.arena != NULL) write_value_array(&vm.arena_globals, temp);
+                if (add_entry(&vm.globals, temp, pop()) && !vm.redefining) {
                     runtime_error("redefinition of global variable '%s'.", AS_STRING(temp)->chars);
                     return RUNTIME_ERROR;
                 }
@@ -411,6 +631,8 @@ InterpretResult execute() {
                 entry = get_entry(&vm.globals, temp);
 
                 if (entry != NULL) {
+                    if (vm.arena != NULL) write_value_array(&vm.arena_globals, temp);
+                    if (!intern_global_value(peek_pointer(0))) return memory_error();
                     entry->value = peek(0);
                     entry->key = temp;
                 } else {
@@ -427,12 +649,73 @@ InterpretResult execute() {
                 index = read_generic_constant_index();
                 set_local(index, peek(0));
                 break;
+            case OP_DEFINE_LOCAL:
+                index = read_generic_constant_index();
+                set_local(index, pop());
+                break;
             case OP_CLOCK:
                 push(NEW_DECIMAL((double) clock() / CLOCKS_PER_SEC));
                 break;
             case OP_TYPEOF:
                 cstr = type_to_string(pop());
                 push(NEW_OBJECT(make_objstring(cstr, strlen(cstr))));
+                COLLECT_IF_NEEDED();
+                break;
+            case OP_IMPORT:
+                index = read_generic_constant_index();
+                if (import_module(text_chars(&READ_CONSTANT(index))) != NO_ERRORS) return RUNTIME_ERROR;
+                break;
+            case OP_INDEX:
+                if (!IS_TEXT(peek(1))) {
+                    runtime_error("unsupported operand type for []: %s.", type_to_string(peek(1)));
+                    return RUNTIME_ERROR;
+                }
+                if (!IS_INTEGER(peek(0))) {
+                    runtime_error("string index must be an integer, not %s.", type_to_string(peek(0)));
+                    return RUNTIME_ERROR;
+                }
+
+                resi = pop().as.integer;
+                if (resi < 0) resi += TEXT_LENGTH(peek(0));
+                if (resi < 0 || resi >= TEXT_LENGTH(peek(0))) {
+                    runtime_error("string index out of range.");
+                    return RUNTIME_ERROR;
+                }
+
+                *peek_pointer(0) = slice_text(peek(0), (int) resi, 1);
+                break;
+            case OP_SLICE:
+                if (!IS_TEXT(peek(2))) {
+                    runtime_error("unsupported operand type for [:]: %s.", type_to_string(peek(2)));
+                    return RUNTIME_ERROR;
+                }
+                if ((!IS_INTEGER(peek(1)) && !IS_NIL(peek(1))) || (!IS_INTEGER(peek(0)) && !IS_NIL(peek(0)))) {
+                    runtime_error("slice bounds must be integers or nil.");
+                    return RUNTIME_ERROR;
+                }
+
+                temp = slice(peek_pointer(2));
+                if (IS_NIL(temp)) return memory_error();
+                pop_n(3);
+                push(temp);
+                COLLECT_IF_NEEDED();
+                break;
+            case OP_METHOD:
+                index = READ_BYTE();
+                if (index >= STRING_METHODS) {
+                    runtime_error("An error occurred.");
+                    return RUNTIME_ERROR;
+                }
+                if (call_method((StringMethod) index, peek_pointer(string_methods[index].arity)) != NO_ERRORS) {
+                    return RUNTIME_ERROR;
+                }
+                COLLECT_IF_NEEDED();
+                break;
+            case OP_JUMP_IF_FALSE_SHORT:
+                index = READ_BYTE();
+                if (!is_true(peek(0))) {
+                    vm.ip += index;
+                }
                 break;
             case OP_JUMP_IF_FALSE:
                 index = READ_CONSTANT_LONG_INDEX();
@@ -440,10 +723,24 @@ InterpretResult execute() {
                     vm.ip += index;
                 }
                 break;
+            case OP_JUMP_IF_FALSE_WIDE:
+                index = READ_WIDE_INDEX();
+                if (!is_true(peek(0))) {
+                    vm.ip += index;
+                }
+                break;
+            case OP_JUMP_SHORT:
+                index = READ_BYTE();
+                vm.ip += index;
+                break;
             case OP_JUMP:
                 index = READ_CONSTANT_LONG_INDEX();
                 vm.ip += index;
                 break;
+            case OP_JUMP_WIDE:
+                index = READ_WIDE_INDEX();
+                vm.ip += index;
+                break;
             case OP_ERROR:
                 runtime_error("Undefined error occurred during execution.");
                 return RUNTIME_ERROR;
@@ -454,20 +751,192 @@ InterpretResult execute() {
 #undef BINARY_INTEGER_OPERATION
 }
 
-InterpretResult interpret(const char *source) {
+// the chunk run last lives no longer than the call that ran it, a collection after it must not mark its constants
+static InterpretResult leave_chunk(InterpretResult result) {
+    vm.chunk = NULL;
+    vm.ip = NULL;
+    return result;
+}
+
+static InterpretResult segment_result;
+static const SourceFile *segment_file;
+static BytecodeWriter *segment_writer;
+
+static bool run_segment(Chunk *chunk, const char *resume) {
+    // the source already compiled is not needed anymore
+    if (segment_file != NULL) release_source_file(segment_file, resume);
+    if (segment_writer != NULL) write_bytecode_segment(segment_writer, chunk);
+
+    vm.chunk = chunk;
+    vm.ip = vm.chunk->code;
+
+    segment_result = execute();
+    return segment_result == NO_ERRORS;
+}
+
+static InterpretResult module_result;
+
+static bool run_module_segment(Chunk *chunk, const char *) {
+    vm.chunk = chunk;
+    vm.ip = vm.chunk->code;
+
+    module_result = execute();
+    return module_result == NO_ERRORS;
+}
+
+// a relative path starts from the directory of the file importing it, or from the working directory in the REPL
+static bool resolve_module(const char *path, char *resolved) {
+    char joined[PATH_MAX];
+    const char *slash = vm.script_path == NULL || path[0] == '/' ? NULL : strrchr(vm.script_path, '/');
+    if (slash != NULL) {
+        int length = snprintf(joined, sizeof(joined), "%.*s/%s", (int) (slash - vm.script_path), vm.script_path, path);
+        if (length < 0 || length >= (int) sizeof(joined)) return false;
+        path = joined;
+    }
+
+    return realpath(path, resolved) != NULL;
+}
+
+static int64_t modification_time(const struct stat *info) {
+    return info->st_mtim.tv_sec * 1000000000 + info->st_mtim.tv_nsec;
+}
+
+static char main_script[PATH_MAX];
+
+void register_script(const char *path) {
+    struct stat info;
+    if (realpath(path, main_script) == NULL || stat(main_script, &info) != 0) return;
+
+    vm.script_path = main_script;
+    add_entry(&vm.modules, NEW_OBJECT(make_objstring(main_script, (int) strlen(main_script))),
+              NEW_INTEGER(modification_time(&info)));
+}
+
+/*
+ * Compiles and runs a module the first time it is imported, and again only once the file has been
+ * modified or if it failed. Its names are interned in vm.strings, so the importer's constants already refer
+ * to its globals. The module runs at the import statement, not on the first use of one of its globals.
+ */
+static InterpretResult import_module(const char *path) {
+    char resolved[PATH_MAX];
+    struct stat info;
+    if (!resolve_module(path, resolved) || stat(resolved, &info) != 0) {
+        runtime_error("could not find module '%s'.", path);
+        return RUNTIME_ERROR;
+    }
+
+    Value key = NEW_OBJECT(make_objstring(resolved, (int) strlen(resolved)));
+    Value modified = NEW_INTEGER(modification_time(&info));
+
+    Entry *entry = get_entry(&vm.modules, key);
+    if (entry != NULL && IS_INTEGER(entry->value) && entry->value.as.integer == modified.as.integer) return NO_ERRORS;
+
+    SourceFile file;
+    if (!map_source_file(resolved, &file)) {
+        runtime_error("could not read module '%s'.", path);
+        return RUNTIME_ERROR;
+    }
+
+    // a module run before, to the end or not, defines its globals again
+    bool redefining = vm.redefining;
+    vm.redefining = entry != NULL;
+
+    // recorded before it runs, so that a module imported back while it runs is not run again
+    add_entry(&vm.modules, key, modified);
+
+    ChunkFrame importer = {vm.chunk, vm.suspended};
+    vm.suspended = &importer;
+    uint8_t *ip = vm.ip;
+    bool repl = vm.repl;
+    const char *script_path = vm.script_path;
+    vm.repl = false;
+    vm.script_path = resolved;
+    module_result = NO_ERRORS;
+
     Chunk chunk;
     init_chunk(&chunk);
-
-    if (!compile(&chunk, source)) {
-        free_chunk(&chunk);
-        return COMPILE_ERROR;
+    bool compiled = compile_segments(&chunk, file.chars, file.length, &vm.strings, run_module_segment);
+    InterpretResult result = compiled ? module_result : COMPILE_ERROR;
+    free_chunk(&chunk);
+    unmap_source_file(&file);
+
+    vm.chunk = importer.chunk;
+    vm.suspended = importer.previous;
+    vm.ip = ip;
+    vm.repl = repl;
+    vm.script_path = script_path;
+    vm.redefining = redefining;
+
+    if (result != NO_ERRORS) {
+        // imported again, it runs again
+        add_entry(&vm.modules, key, NIL);
+        if (result == COMPILE_ERROR) runtime_error("could not compile module '%s'.", path);
+        return RUNTIME_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    return NO_ERRORS;
+}
 
-    InterpretResult result = execute();
+InterpretResult interpret(const char *source, size_t length) {
+    // the compiler gives up past the budget, garbage left by the previous call must not count
+    if (!within_budget(0)) collect_garbage();
+    if (vm.arena != NULL) enter_arena();
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    segment_result = NO_ERRORS;
+
+    bool compiled;
+    if (vm.parallel_lex) {
+        // the tokens of the whole file are in memory anyway, so it is compiled in one piece
+        compiled = compile_parallel(&chunk, source, length, &vm.strings, NULL);
+        if (compiled) run_segment(&chunk, NULL);
+    } else {
+        compiled = compile_segments(&chunk, source, length, &vm.strings, run_segment);
+    }
 
     free_chunk(&chunk);
+    if (vm.arena != NULL) leave_arena();
+    return leave_chunk(compiled ? segment_result : COMPILE_ERROR);
+}
+
+InterpretResult interpret_file(const SourceFile *file, BytecodeWriter *cache) {
+    segment_file = file;
+    segment_writer = cache;
+    InterpretResult result = interpret(file->chars, file->length);
+    segment_file = NULL;
+    segment_writer = NULL;
     return result;
-}
\ No newline at end of file
+}
+
+InterpretResult interpret_bytecode(Bytecode *bytecode) {
+    InterpretResult result = NO_ERRORS;
+
+    Chunk chunk;
+    while (result == NO_ERRORS && bytecode->segment < bytecode->segment_count) {
+        if (!next_bytecode_segment(bytecode, &chunk)) {
+            fprintf(stderr, "Corrupted bytecode file.\n");
+            return leave_chunk(COMPILE_ERROR);
+        }
+
+        vm.chunk = &chunk;
+        vm.ip = vm.chunk->code;
+        result = execute();
+    }
+
+    return leave_chunk(result);
+}
+
+InterpretResult execute_chunk(Chunk *chunk) {
+    // constants were interned by a compiler with a table of its own, runtime strings must find the same objects
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value *constant = &chunk->constants.values[i];
+        if (IS_STRING(*constant)) {
+            *constant = NEW_OBJECT(make_objstring(AS_STRING(*constant)->chars, AS_STRING(*constant)->length));
+        }
+    }
+
+    vm.chunk = chunk;
+    vm.ip = vm.chunk->code;
+    return leave_chunk(execute());
+}
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include "chunk.h"
 #include "hashmap.h"
+#include "source_file.h"
+#include "bytecode.h"
+#include "memory.h"
 
 typedef enum {
     NO_ERRORS,
@@ -11,19 +14,48 @@ typedef enum {
     RUNTIME_ERROR
 } InterpretResult;
 
+// a chunk whose run is suspended while a module it imports runs
+typedef struct ChunkFrame {
+    Chunk *chunk;
+    struct ChunkFrame *previous;
+} ChunkFrame;
+
 typedef struct {
     bool repl;
+    bool parallel_lex;
     Chunk *chunk;
+    ChunkFrame *suspended;
     uint8_t *ip;
     Value stack[256];
     Value *stack_top;
     Hashmap strings;
     Hashmap globals;
+    Hashmap modules;    // resolved path of every module imported -> its modification time when it ran, nil if it failed
+    const char *script_path;    // resolved path of the file running, relative imports start from its directory
+    bool redefining;            // a module runs again, its definitions replace those of its earlier run
     struct {
         int size;
         int capacity;
         Value *local;
     } locals;
+    Object *objects;            // every rope, and every string in vm.strings but those of mapped files
+    struct {
+        Object **objects;
+        int count;
+        int capacity;
+    } gray;                     // ropes marked whose pieces are not yet
+    size_t bytes_allocated;
+    size_t next_gc;             // the next collection runs once bytes_allocated goes past it
+    size_t gc_threshold;        // next_gc never goes below it
+    SlabAllocator slabs;
+    Allocator allocator;        // may be replaced by an embedder between init_vm() and the first allocation
+    Allocator heap_allocator;   // the allocator set aside while the arena is installed
+    Arena *arena;               // when set, everything an interpret() call leaves unreachable is freed at once
+    ValueArray arena_globals;   // the names of the globals written while the arena is installed
+    size_t memory_limit;        // bytes the VM may have allocated at once, 0 for no limit, set before allocating
+    atomic_size_t memory_used;  // only counted under a limit
+    bool memory_stats;          // counts every allocation by category, set before allocating
+    MemoryCounters memory[MEMORY_CATEGORY_COUNT + 1];  // the last one adds up the others
 } VM;
 
 extern VM vm;
@@ -32,7 +64,16 @@ void init_vm();
 
 void free_vm();
 
-InterpretResult interpret(const char *source);
+InterpretResult interpret(const char *source, size_t length);
+
+InterpretResult interpret_file(const SourceFile *file, BytecodeWriter *cache);
+
+// records the script about to run as imported already, importing it back does not run it a second time
+void register_script(const char *path);
+
+InterpretResult interpret_bytecode(Bytecode *bytecode);
+
+InterpretResult execute_chunk(Chunk *chunk);
 
 
 #endif //FILANG_VM_H